@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include "nimd.h"
+
+// Board state of a single game. Boards are plain bytes so the event loop can
+// keep thousands of them packed next to each other.
+//
+// Every game on a server plays the same rules, set once before the first game
+// by board_configure. The per-move routines come in copies specialized for the
+// common pile counts, where the count is a compile-time constant and the loops
+// unroll into straight-line code; other counts use a generic copy.
+
+Rules rules = { 5, { 1, 3, 5, 7, 9 }, 0, 0 };
+
+static inline int take_n(Board *b, int pile_idx, int count, int n) {
+    // check pile index range
+    if((unsigned int)pile_idx >= (unsigned int)n) {
+        return FAIL_PILE;
+    }
+
+    // check count range, and the cap if the rules have one
+    if(count < 1 || count > b->piles[pile_idx] ||
+       (rules.max_take && count > rules.max_take)) {
+        return FAIL_QUANTITY;
+    }
+
+    b->piles[pile_idx] -= count;
+    b->stones -= count;
+    b->last = pile_idx;
+    b->seq++;
+    return 0;
+}
+
+static inline char *render_n(const Board *b, char *p, int n) {
+    int i;
+
+    p = put_count(p, b->piles[0]);
+    for(i = 1; i < n; i++) {
+        *p++ = ' ';
+        p = put_count(p, b->piles[i]);
+    }
+    return p;
+}
+
+#define BOARD_KERNELS(N)                                                    \
+    static int take_##N(Board *b, int pile_idx, int count) {                \
+        return take_n(b, pile_idx, count, N);                               \
+    }                                                                       \
+    static char *render_##N(const Board *b, char *p) {                      \
+        return render_n(b, p, N);                                           \
+    }
+
+BOARD_KERNELS(3)
+BOARD_KERNELS(4)
+BOARD_KERNELS(5)
+BOARD_KERNELS(6)
+BOARD_KERNELS(7)
+
+static int take_any(Board *b, int pile_idx, int count) {
+    return take_n(b, pile_idx, count, rules.npiles);
+}
+
+static char *render_any(const Board *b, char *p) {
+    return render_n(b, p, rules.npiles);
+}
+
+static const struct {
+    int (*take)(Board *b, int pile_idx, int count);
+    char *(*render)(const Board *b, char *p);
+} kernels[] = {
+    [3] = { take_3, render_3 },
+    [4] = { take_4, render_4 },
+    [5] = { take_5, render_5 },
+    [6] = { take_6, render_6 },
+    [7] = { take_7, render_7 },
+};
+
+#define NKERNELS ((int)(sizeof(kernels) / sizeof(kernels[0])))
+
+static int (*take_fn)(Board *, int, int) = take_5;
+static char *(*render_fn)(const Board *, char *) = render_5;
+static int start_stones = 25;
+
+// set the rules from a comma separated list of starting pile sizes such as
+// "1,3,5,7,9" (NULL keeps the piles), returns -1 if the list is not 1 to
+// MAX_PILES counts of 0-255 with at least one stone
+int board_configure(const char *sizes, int misere, int max_take) {
+    Rules r;
+    const char *p = sizes;
+    char *end;
+    long v;
+    int i;
+
+    memset(&r, 0, sizeof(r));
+    if(sizes == NULL) {
+        r = rules;
+    } else {
+        for(;;) {
+            v = strtol(p, &end, 10);
+            if(end == p || v < 0 || v > 255 || r.npiles == MAX_PILES) return -1;
+            r.start[r.npiles++] = v;
+            if(*end == '\0') break;
+            if(*end != ',') return -1;
+            p = end + 1;
+        }
+    }
+    r.misere = misere;
+    r.max_take = max_take;
+
+    start_stones = 0;
+    for(i = 0; i < r.npiles; i++) start_stones += r.start[i];
+    if(start_stones == 0) return -1;
+
+    rules = r;
+    if(r.npiles < NKERNELS && kernels[r.npiles].take != NULL) {
+        take_fn = kernels[r.npiles].take;
+        render_fn = kernels[r.npiles].render;
+    } else {
+        take_fn = take_any;
+        render_fn = render_any;
+    }
+    return 0;
+}
+
+// set up the starting piles with player 1 to move
+void board_init(Board *b) {
+    memcpy(b->piles, rules.start, sizeof(b->piles));
+    b->stones = start_stones;
+    b->seq = 0;
+    b->last = 0;
+    b->turn = 1;
+}
+
+// total stones left on the board
+int board_stones(const Board *b) {
+    return b->stones;
+}
+
+// who won once the last stone is gone, 0 while the game goes on; mover just
+// took a stone, which wins normal play and loses misere play
+int board_winner(const Board *b, int mover) {
+    if(b->stones != 0) return 0;
+    return rules.misere ? 3 - mover : mover;
+}
+
+// check a move, returns 0 and applies it if legal, otherwise the FAIL code
+int board_take(Board *b, int pile_idx, int count) {
+    return take_fn(b, pile_idx, count);
+}
+
+// render the piles as space separated counts, e.g. "1 3 5 7 9", at p
+// returns the end of what was written, nothing is terminated
+char *board_render(const Board *b, char *p) {
+    return render_fn(b, p);
+}
@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <string.h>
+#include "nimd.h"
+
+// Built-in opponent for players nobody else comes for. It plays perfectly:
+// under normal play it moves to a zero nim-sum whenever it can, under misere
+// it does the same until the move would leave only piles of one, and then
+// leaves an odd number of them. With a cap on how much a move may take the
+// nim-sum no longer applies, and the bot asks the solver instead, see solve.c.
+//
+// The event loop hands over every board whose bot move is due in a round in
+// one call, but each is still planned on its own. Without a cap, a board's
+// piles are read as two 64-bit words, so its nim-sum is two XORs and a fold,
+// and the pile that brings it to zero is found with a mask and a count of
+// trailing zeros. The misere endgame and a lost position still look at the
+// piles one by one, and a capped board goes to solve_move.
+
+_Static_assert(MAX_PILES == 16, "bot reads the piles as two 64-bit words");
+
+#define ONES 0x0101010101010101ULL
+
+int bot_after_ms = -1;
+const char bot_name[] = "NimBot";
+
+// first byte of the pair with any bit of mask set, the pair must have one
+static int first_byte(const uint64_t w[2], uint64_t mask) {
+    uint64_t lo = w[0] & mask;
+
+    if(lo) return __builtin_ctzll(lo) / 8;
+    return 8 + __builtin_ctzll(w[1] & mask) / 8;
+}
+
+static void plan(const Board *b, BotMove *m) {
+    uint64_t w[2], x;
+    int i, nbig, nones, big;
+
+    if(rules.max_take) {
+        solve_move(b, m);
+        return;
+    }
+
+    memcpy(w, b->piles, sizeof(w));
+    x = w[0] ^ w[1];
+    x ^= x >> 32;
+    x ^= x >> 16;
+    x ^= x >> 8;
+    x &= 0xff;
+
+    if(rules.misere) {
+        nbig = nones = 0;
+        big = 0;
+        for(i = 0; i < rules.npiles; i++) {
+            if(b->piles[i] > 1) {
+                nbig++;
+                big = i;
+            } else {
+                nones += b->piles[i];
+            }
+        }
+
+        // endgame: leave the opponent an odd number of piles of one
+        if(nbig == 1) {
+            m->pile = big;
+            m->count = b->piles[big] - (nones % 2 ? 0 : 1);
+            return;
+        }
+        if(nbig == 0) {
+            m->pile = first_byte(w, ONES);
+            m->count = 1;
+            return;
+        }
+    }
+
+    if(x != 0) {
+        // some pile has the nim-sum's top bit set, shrinking it to pile ^ x
+        // brings the nim-sum to zero
+        m->pile = first_byte(w, ONES << (31 - __builtin_clz((unsigned int)x)));
+        m->count = b->piles[m->pile] - (b->piles[m->pile] ^ x);
+        return;
+    }
+
+    // a lost position, take one stone from the biggest pile and hope
+    big = 0;
+    for(i = 1; i < rules.npiles; i++) {
+        if(b->piles[i] > b->piles[big]) big = i;
+    }
+    m->pile = big;
+    m->count = 1;
+}
+
+// choose the bot's move on each of n boards, none of which may be empty, one
+// board after another
+void bot_plan(const Board *const *boards, int n, BotMove *moves) {
+    int i;
+
+    for(i = 0; i < n; i++) {
+        plan(boards[i], &moves[i]);
+    }
+}
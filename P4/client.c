@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include "nimd.h"
+
+// Client side of NGP, shared by tests and nimbench.
+
+// look host and port up once, for as many connections as it takes
+struct addrinfo *client_resolve(const char *hostname, const char *port) {
+    struct addrinfo hints, *servinfo;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if(getaddrinfo(hostname, port, &hints, &servinfo) != 0) return NULL;
+    return servinfo;
+}
+
+// connect to the first address that takes, without Nagle's delay; flags is 0
+// or SOCK_NONBLOCK, and a non-blocking connect may still be in progress when
+// this returns
+int client_connect(const struct addrinfo *servinfo, int flags) {
+    const struct addrinfo *info;
+    int sockfd, one = 1;
+
+    for(info = servinfo; info != NULL; info = info->ai_next) {
+        sockfd = socket(info->ai_family, info->ai_socktype | flags, info->ai_protocol);
+        if(sockfd == -1) continue;
+
+        // a frame split on purpose must not wait on the ACK of its first part
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if(connect(sockfd, info->ai_addr, info->ai_addrlen) == -1 && errno != EINPROGRESS) {
+            close(sockfd);
+            continue;
+        }
+        return sockfd;
+    }
+    return -1;
+}
+
+// Connect to server
+int connect_to_server(const char *hostname, const char *port) {
+    struct addrinfo *servinfo = client_resolve(hostname, port);
+    int sockfd;
+
+    if(servinfo == NULL) return -1;
+    sockfd = client_connect(servinfo, 0);
+    freeaddrinfo(servinfo);
+    return sockfd;
+}
+
+void send_raw(int fd, const char *msg) {
+    write(fd, msg, strlen(msg));
+}
+
+// send a frame made by one of the ngp_encode functions, which may hold NULs
+void send_frame(int fd, const char *frame, int len) {
+    write(fd, frame, len);
+}
+
+// Send formatted NGP message
+void send_ngp(int fd, const char *body) {
+    char msg[1024];
+    snprintf(msg, sizeof(msg), "0|%02lu|%s", strlen(body), body);
+    write(fd, msg, strlen(msg));
+}
+
+static long long client_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// the next frame from fd, whatever TCP split or merged, waiting at most until
+// deadline (ms on the monotonic clock); copies it to frame, NUL terminated,
+// and returns its length, 0 if the server closed first, -1 on a timeout or
+// a stream that is not NGP
+int read_frame(int fd, Framer *in, char frame[NGP_MAX_FRAME + 1], long long deadline) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    char scratch[NGP_MAX_FRAME];
+    const char *next;
+    long long left;
+    int n;
+
+    for(;;) {
+        n = framer_next(in, &next, scratch);
+        if(n < 0) return -1;
+        if(n > 0) {
+            memcpy(frame, next, n);
+            frame[n] = '\0';
+            return n;
+        }
+
+        left = deadline - client_ms();
+        if(left <= 0) return -1;
+        n = poll(&pfd, 1, (int)left);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+
+        n = framer_read(in, fd, MSG_DONTWAIT);
+        if(n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if(n <= 0) return n;
+    }
+}
+
+// a deadline ms from now, for read_frame
+long long deadline_in(int ms) {
+    return client_ms() + ms;
+}
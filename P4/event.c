@@ -0,0 +1,1442 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "nimd.h"
+
+// Event loop server: every worker thread is a shard with its own listening
+// socket (SO_REUSEPORT), its own epoll loop and its own table of games, so a
+// MOVE never touches anything another thread can see. The only cross-shard
+// traffic is matchmaking, done through a lock-free lobby slot and per-shard
+// inboxes. Client sockets never block: output is queued per connection and
+// flushed once at the end of each loop round, see outq.c.
+//
+// Players who sent OPEN join their shard's FIFO queue, and the queue is paired
+// off in one batch at the end of each loop round; only an odd one left over
+// goes to the lobby. With -B, a player still waiting after that long plays
+// the built-in bot instead; the bot's moves for every game on the shard are
+// planned together at the end of the round, see bot.c.
+//
+// Each shard keeps a timer wheel with one deadline per connection, for what
+// its state owes: OPEN, the move when it is the player's turn, or any sign of
+// life while waiting or after the game (-O, -T, -I). A missed turn forfeits.
+//
+// With -R a player who disconnects mid-game is held rather than forfeited: the
+// Conn stays in the game without a socket for the grace period, and an OPEN
+// with the player's name and session token, on whichever shard it lands,
+// is sent to the game's shard and takes the seat back, see names.c.
+//
+// With -J every game is journaled: its start, each move and how it ended go
+// to this thread's ring in the journal, stamped with the shard's clock, see
+// journal.c.
+//
+// What happens to players and games goes to the structured log as events
+// (waiting, matched, moved, over, ...) carrying the game's id and how long the
+// step took, see log.c; a move is a debug event, so the default info level
+// costs a game one line at the start and one at the end. With -S the shard
+// also counts into its own metrics slot, see metrics.c.
+//
+// Fork mode uses shards too: the parent is one shard whose matched pairs are
+// handed to worker processes (event_parent), and each worker is one shard
+// without a listener that plays what the parent sends it (pool_worker).
+
+#define MAX_EVENTS 256
+#define LOBBY_RETRY_MS 10 // how often an unpublished waiter retries the lobby
+
+// where a connection is in the NGP exchange
+enum {
+    CONN_NEW,      // accepted, OPEN not seen yet
+    CONN_WAITING,  // sent WAIT, no opponent yet
+    CONN_PLAYING,  // in a game
+    CONN_CLOSING,  // game over, write side shut, waiting for the peer to close
+    CONN_HELD,     // dropped out of a game, seat kept for -R ms, no socket
+    CONN_DEAD      // closed while promised to another shard, freed on handoff
+};
+
+typedef struct Shard Shard;
+typedef struct Conn Conn;
+
+struct Conn {
+    Player p;
+    Shard *shard;     // shard whose epoll owns the socket
+    int state;
+    int game;         // slot in the game table while playing
+    int id;           // 1 or 2 within the game
+    int named;        // holds a claim on p.name
+    int published;    // sitting in the lobby for other shards to take
+    int want_out;     // epoll also watches for writability
+    int queued;       // in the shard's waiting queue
+    int fresh;        // joined the queue this round, frames after OPEN wait
+                      // to see whether the round's pairing gives it a game
+    long long since;  // when it joined the waiting queue, ms
+    Timer timer;      // deadline for whatever this state is waiting on
+    unsigned long long token;   // with -R, what the player resumes the game with
+
+    // waiting queue links
+    Conn *qprev;
+    Conn *qnext;
+
+    // handoff to another shard: this connection should play partner, or
+    // with none, take back its seat in game
+    Conn *partner;
+    Conn *next;
+};
+
+// per-game bookkeeping, the board itself lives in a parallel array
+typedef struct {
+    int active;
+    Conn *players[2];   // NULL for the bot or a player who left
+    int bot;            // player number the bot plays, 0 if two people play
+    int next_free;  // free list link while inactive
+    int job;        // fork mode parent's slot for this game, -1 otherwise
+    unsigned long long jgame;   // key of its journal records
+    unsigned long long id;      // names it in the log: shard, then a count
+    long long started;          // shard clock when it started, ms
+    long long turn_at;          // when the player to move got the board, ms
+} EvGame;
+
+struct Shard {
+    int index;
+    int epfd;
+    int listen_fd;
+    int wake_fd;    // eventfd poked when something lands in the inbox
+    int job_fd;     // pool worker: matched pairs from the parent, else -1
+    int done_fd;    // pool worker: where finished games are reported
+    int *job_games; // pool worker: game slot of each parent slot, -1 if none
+    int jring;      // journal ring this thread records to
+    unsigned int gseq;  // games started here, for their log ids
+    int metrics_slot;   // where -S counts this thread
+    long long round_us; // with -S, when epoll returned this round, us
+    PoolParent *parent;  // fork mode parent: where matched pairs go
+
+    // connections indexed by fd
+    Conn **conns;
+    int conns_cap;
+
+    // game table with a free list of unused slots; boards[g] is the board of
+    // gtab[g], kept in its own array so a move only touches a few packed bytes
+    EvGame *gtab;
+    Board *boards;
+    int gtab_cap;
+    int free_head;
+    int active_games;
+    int game_limit;
+
+    // players waiting for an opponent, oldest first
+    Conn *wait_head;
+    Conn *wait_tail;
+    int nwaiting;
+
+    // games where it is the bot's turn, moved at the end of the round
+    int *bot_due;
+    int nbot_due;
+    int bot_cap;
+
+    // connections handed over by other shards, multi-producer stack
+    _Atomic(Conn *) inbox;
+
+    Wheel wheel;
+};
+
+int open_timeout_ms;
+int turn_timeout_ms;
+int idle_timeout_ms;
+
+// a lone waiting player any shard may take
+static _Atomic(Conn *) lobby;
+
+static Shard *shards;
+static int nshards;
+
+static void conn_pump(Shard *s, Conn *c);
+static void forfeit(Shard *s, Conn *c);
+
+static long long now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void queue_push(Shard *s, Conn *c) {
+    c->qprev = s->wait_tail;
+    c->qnext = NULL;
+    if(s->wait_tail != NULL) s->wait_tail->qnext = c;
+    else s->wait_head = c;
+    s->wait_tail = c;
+    c->queued = 1;
+    s->nwaiting++;
+}
+
+static void queue_remove(Shard *s, Conn *c) {
+    if(!c->queued) return;
+    if(c->qprev != NULL) c->qprev->qnext = c->qnext;
+    else s->wait_head = c->qnext;
+    if(c->qnext != NULL) c->qnext->qprev = c->qprev;
+    else s->wait_tail = c->qprev;
+    c->qprev = c->qnext = NULL;
+    c->queued = 0;
+    s->nwaiting--;
+}
+
+static Conn *queue_pop(Shard *s) {
+    Conn *c = s->wait_head;
+
+    if(c != NULL) queue_remove(s, c);
+    return c;
+}
+
+// arm c's deadline for the state it is in, or clear it if there is none
+static void conn_timer(Shard *s, Conn *c) {
+    int ms = 0;
+
+    switch(c->state) {
+    case CONN_NEW:
+        ms = open_timeout_ms;
+        break;
+    case CONN_WAITING:
+    case CONN_CLOSING:
+        ms = idle_timeout_ms;
+        break;
+    case CONN_PLAYING:
+        if(s->boards[c->game].turn == c->id) ms = turn_timeout_ms;
+        break;
+    case CONN_HELD:
+        return;     // the grace period runs on whatever happens in the game
+    }
+
+    if(ms > 0) timer_arm(&s->wheel, &c->timer, s->wheel.now + ms);
+    else timer_cancel(&s->wheel, &c->timer);
+}
+
+static int conn_table_fit(Shard *s, int fd) {
+    if(fd >= s->conns_cap) {
+        int cap = s->conns_cap ? s->conns_cap : 1024;
+        Conn **grown;
+
+        while(cap <= fd) cap *= 2;
+        grown = realloc(s->conns, cap * sizeof(*s->conns));
+        if(grown == NULL) return -1;
+        memset(grown + s->conns_cap, 0, (cap - s->conns_cap) * sizeof(*s->conns));
+        s->conns = grown;
+        s->conns_cap = cap;
+    }
+    return 0;
+}
+
+// register a connection with this shard's epoll
+static int conn_attach(Shard *s, Conn *c) {
+    struct epoll_event ev;
+
+    if(conn_table_fit(s, c->p.fd) == -1) return -1;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = c->p.fd;
+    if(epoll_ctl(s->epfd, EPOLL_CTL_ADD, c->p.fd, &ev) == -1) return -1;
+
+    c->shard = s;
+    c->want_out = 0;
+    s->conns[c->p.fd] = c;
+    return 0;
+}
+
+// take a connection out of this shard so another one can adopt it
+static void conn_detach(Shard *s, Conn *c) {
+    epoll_ctl(s->epfd, EPOLL_CTL_DEL, c->p.fd, NULL);
+    s->conns[c->p.fd] = NULL;
+    c->shard = NULL;
+}
+
+static Conn *conn_add(Shard *s, int fd) {
+    Conn *c = calloc(1, sizeof(*c));
+
+    if(c == NULL) return NULL;
+    c->p.fd = fd;
+    c->state = CONN_NEW;
+    c->game = -1;
+
+    if(conn_attach(s, c) == -1) {
+        free(c);
+        return NULL;
+    }
+    conn_timer(s, c);
+    return c;
+}
+
+// take our own waiter back out of the lobby, fails if another shard already
+// took it, in which case a handoff for it is on its way to our inbox
+static int lobby_reclaim(Conn *c) {
+    Conn *expected = c;
+
+    if(!c->published) return 1;
+    if(atomic_compare_exchange_strong(&lobby, &expected, NULL)) {
+        c->published = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// forget a connection and close its socket, closing drops it from epoll
+static void conn_close(Conn *c) {
+    Shard *s = c->shard;
+    int promised = 0;
+
+    queue_remove(s, c);
+    timer_cancel(&s->wheel, &c->timer);
+    if(c->state == CONN_WAITING && !lobby_reclaim(c)) promised = 1;
+
+    if(c->named) name_release(c->p.name);
+    c->named = 0;
+
+    // last try for a FAIL we queued, the socket buffer almost always has room
+    out_unpend(&c->p);
+    if(c->p.fd >= 0) out_flush(&c->p);
+    out_release(&c->p.out);
+
+    // a held seat has no socket
+    if(c->p.fd >= 0) {
+        s->conns[c->p.fd] = NULL;
+        shutdown(c->p.fd, SHUT_WR);
+        close(c->p.fd);
+    }
+
+    if(promised) {
+        // the shard that took it will hand us a partner naming this conn
+        c->state = CONN_DEAD;
+        return;
+    }
+    free(c);
+}
+
+// game is over for this player, let the peer read what we sent before we close
+static void conn_linger(Conn *c) {
+    c->state = CONN_CLOSING;
+    c->game = -1;
+    if(c->named) name_release(c->p.name);
+    c->named = 0;
+    conn_timer(c->shard, c);
+
+    // otherwise the flush that empties the queue shuts the write side
+    if(c->p.out.head == c->p.out.tail) shutdown(c->p.fd, SHUT_WR);
+}
+
+// a client that stopped reading or whose socket broke, forfeits any game
+static void conn_drop(Shard *s, Conn *c) {
+    if(c->state == CONN_PLAYING) {
+        LOG(LOG_NOT_READING, .game = s->gtab[c->game].id, .player = c->id, .name = c->p.name);
+        forfeit(s, c);
+        return;
+    }
+    conn_close(c);
+}
+
+// push queued output to the socket, epoll watches for room while some is left
+static void conn_flush(Shard *s, Conn *c) {
+    struct epoll_event ev;
+    int left;
+
+    left = c->p.out.over ? -1 : out_flush(&c->p);
+    if(left < 0) {
+        conn_drop(s, c);
+        return;
+    }
+
+    if((left > 0) != c->want_out) {
+        c->want_out = left > 0;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = c->want_out ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.fd = c->p.fd;
+        epoll_ctl(s->epfd, EPOLL_CTL_MOD, c->p.fd, &ev);
+    }
+
+    if(left == 0 && c->state == CONN_CLOSING) shutdown(c->p.fd, SHUT_WR);
+}
+
+// end of a loop round: one writev per connection that has output queued
+static void flush_pending(Shard *s) {
+    Player *p;
+
+    while((p = out_next_pending()) != NULL) {
+        conn_flush(s, s->conns[p->fd]);
+    }
+}
+
+static int game_alloc(Shard *s) {
+    int g;
+
+    if(s->active_games >= s->game_limit) return -1;
+
+    if(s->free_head == -1) {
+        int cap = s->gtab_cap ? s->gtab_cap * 2 : 1024;
+        EvGame *grown;
+        Board *grown_boards;
+
+        if(cap > s->game_limit) cap = s->game_limit;
+        grown = realloc(s->gtab, cap * sizeof(*s->gtab));
+        if(grown == NULL) return -1;
+        s->gtab = grown;
+        grown_boards = realloc(s->boards, cap * sizeof(*s->boards));
+        if(grown_boards == NULL) return -1;
+        s->boards = grown_boards;
+
+        // thread the new slots onto the free list
+        for(g = cap - 1; g >= s->gtab_cap; g--) {
+            s->gtab[g].active = 0;
+            s->gtab[g].next_free = s->free_head;
+            s->free_head = g;
+        }
+        s->gtab_cap = cap;
+    }
+
+    g = s->free_head;
+    s->free_head = s->gtab[g].next_free;
+    s->active_games++;
+    return g;
+}
+
+static void game_free(Shard *s, int g) {
+    s->gtab[g].active = 0;
+    s->gtab[g].next_free = s->free_head;
+    s->free_head = g;
+    s->active_games--;
+}
+
+// fork mode parent: drop a connection a worker has taken over, without the
+// shutdown that would end it for the worker too
+static void conn_forget(Conn *c) {
+    timer_cancel(&c->shard->wheel, &c->timer);
+    out_unpend(&c->p);
+    out_release(&c->p.out);
+    c->shard->conns[c->p.fd] = NULL;
+    close(c->p.fd);
+    free(c);
+}
+
+static void turn_away(Conn *a, Conn *b) {
+    send_fail(&a->p, FAIL_BUSY);
+    send_fail(&b->p, FAIL_BUSY);
+    a->state = b->state = CONN_NEW;
+    conn_close(a);
+    conn_close(b);
+}
+
+// fork mode parent: a worker plays the game, it keeps the names claimed until
+// it reports the game over; b is NULL against the bot; returns 0 as the
+// connections are gone from here
+static int pool_start(Shard *s, Conn *a, Conn *b) {
+    // the worker can not send what is still queued here, this is only a WAIT
+    // on a fresh socket so it practically always went out already
+    out_unpend(&a->p);
+    if(b != NULL) out_unpend(&b->p);
+    if(out_flush(&a->p) != 0 || (b != NULL && out_flush(&b->p) != 0) ||
+       !s->parent->start_game(&a->p, b ? &b->p : NULL)) {
+        if(b != NULL) {
+            turn_away(a, b);
+        } else {
+            send_fail(&a->p, FAIL_BUSY);
+            a->state = CONN_NEW;
+            conn_close(a);
+        }
+        return 0;
+    }
+
+    conn_forget(a);
+    if(b != NULL) conn_forget(b);
+    return 0;
+}
+
+// player i + 1 of a game, NULL for the bot's side or a player who left or
+// is held
+static Player *game_player(EvGame *game, int i) {
+    Conn *c = game->players[i];
+
+    return c != NULL && c->state != CONN_HELD ? &c->p : NULL;
+}
+
+// with -R, tell a player the token that gets them back into the game; the
+// fork mode parent made it already, otherwise the session starts here
+static void game_session(Shard *s, Conn *c) {
+    if(resume_grace_ms == 0) return;
+    if(c->named) c->token = name_session(c->p.name, s->index, c->game, c->id);
+    if(c->token != 0) send_sess(&c->p, c->token);
+}
+
+// b is NULL to have a play the bot, which always moves second
+// returns 0 if the players were turned away and closed, or sent elsewhere
+static int game_start(Shard *s, Conn *a, Conn *b) {
+    int g;
+    EvGame *game;
+    Board *board;
+    const char *opp = b ? b->p.name : bot_name;
+
+    if(s->parent != NULL) {
+        LOG(LOG_MATCHED, .ms = now_ms() - a->since, .name = a->p.name, .opp = opp);
+        return pool_start(s, a, b);
+    }
+
+    g = game_alloc(s);
+    if(g == -1) {
+        // no room for more games
+        if(b != NULL) {
+            turn_away(a, b);
+        } else {
+            send_fail(&a->p, FAIL_BUSY);
+            a->state = CONN_NEW;
+            conn_close(a);
+        }
+        return 0;
+    }
+
+    game = &s->gtab[g];
+    board = &s->boards[g];
+    game->active = 1;
+    game->job = -1;
+    game->bot = b == NULL ? 2 : 0;
+    board_init(board);
+    game->started = game->turn_at = s->wheel.now;
+    game->id = (unsigned long long)s->index << 32 | ++s->gseq;
+    game->jgame = journal_start(s->jring, a->p.name, opp, game->bot);
+    game->players[0] = a;
+    game->players[1] = b;
+
+    a->state = CONN_PLAYING;
+    a->game = g;
+    a->id = 1;
+    conn_timer(s, a);
+    send_name(&a->p, 1, b ? b->p.name : (char *)bot_name);
+    game_session(s, a);
+
+    if(b != NULL) {
+        b->state = CONN_PLAYING;
+        b->game = g;
+        b->id = 2;
+        conn_timer(s, b);
+        send_name(&b->p, 2, a->p.name);
+        game_session(s, b);
+        metrics_reply(METRIC_OPEN_NAME, a->p.opened > b->p.opened ? a->p.opened : b->p.opened);
+    }
+
+    // a pool worker's players waited in the parent, which logged that
+    LOG(LOG_MATCHED, .ms = s->job_fd < 0 ? now_ms() - a->since : -1, .game = game->id,
+        .name = a->p.name, .opp = opp);
+
+    broadcast_board(board, &a->p, game_player(game, 1));
+    LOG(LOG_PLAY, .game = game->id, .board = board);
+    return 1;
+}
+
+// journal and log a move in game g, its latency is how long the player took
+static void game_moved(Shard *s, int g, int player, int pile, int count) {
+    EvGame *game = &s->gtab[g];
+
+    journal_move(s->jring, &game->jgame, s->wheel.now - game->started, player, pile, count);
+    LOG(LOG_MOVED, .ms = s->wheel.now - game->turn_at, .game = game->id, .player = player,
+        .a = pile, .b = count);
+    game->turn_at = s->wheel.now;
+}
+
+// journal and log how game g ended, its latency is how long the game took
+static void game_result(Shard *s, int g, int winner, int forfeit) {
+    EvGame *game = &s->gtab[g];
+
+    journal_over(s->jring, &game->jgame, s->wheel.now - game->started, winner, forfeit);
+    metrics_time(METRIC_GAME, (s->wheel.now - game->started) * 1000);
+    LOG(LOG_OVER, .ms = s->wheel.now - game->started, .game = game->id, .a = winner,
+        .what = forfeit ? "reason=forfeit" : "reason=normal");
+}
+
+// tell the fork mode parent one of its games is over
+static void job_done(Shard *s, int job) {
+    if(write(s->done_fd, &job, sizeof(job)) != sizeof(job)) perror("job_done");
+}
+
+// end a game, both players linger until they close their side, a held
+// player's seat just goes
+static void game_end(Shard *s, int g) {
+    Conn *c;
+    int i;
+
+    for(i = 0; i < 2; i++) {
+        c = s->gtab[g].players[i];
+        if(c == NULL) continue;
+        if(c->state == CONN_HELD) conn_close(c);
+        else conn_linger(c);
+    }
+    if(s->gtab[g].job >= 0) {
+        s->job_games[s->gtab[g].job] = -1;
+        job_done(s, s->gtab[g].job);
+    }
+    game_free(s, g);
+}
+
+// c came back as player c->id of game c->game: it takes over the held seat,
+// and hears the game from the top; returns 0 as c itself is gone
+static int resume_seat(Shard *s, Conn *c) {
+    EvGame *game = c->game >= 0 && c->game < s->gtab_cap ? &s->gtab[c->game] : NULL;
+    Conn *held = game != NULL && game->active ? game->players[c->id - 1] : NULL;
+    Conn *opp;
+
+    // the game may have ended since, or the player never left it
+    if(held == NULL || held->state != CONN_HELD || held->token != c->token) {
+        send_fail(&c->p, FAIL_PLAYING);
+        conn_close(c);
+        return 0;
+    }
+
+    timer_cancel(&s->wheel, &c->timer);
+    held->p.fd = c->p.fd;
+    held->p.in = c->p.in;
+    held->p.delta = c->p.delta;
+    held->want_out = 0;
+    s->conns[held->p.fd] = held;
+    out_unpend(&c->p);
+    out_release(&c->p.out);
+    free(c);
+
+    LOG(LOG_RESUMED, .game = game->id, .player = held->id, .name = held->p.name);
+    held->state = CONN_PLAYING;
+    conn_timer(s, held);
+
+    opp = game->players[2 - held->id];
+    send_name(&held->p, held->id, opp != NULL ? opp->p.name : (char *)bot_name);
+    send_sess(&held->p, held->token);
+    broadcast_board(&s->boards[held->game], &held->p, NULL);
+    LOG(LOG_PLAY, .game = game->id, .player = held->id, .board = &s->boards[held->game]);
+
+    conn_pump(s, held);
+    return 0;
+}
+
+// give a player to shard to, to play its waiter, or with none to take back
+// a held seat there
+static void handoff(Shard *s, Conn *c, Shard *to, Conn *waiter) {
+    Conn *head;
+    uint64_t one = 1;
+
+    // our thread's pending list and wheel cannot follow c, send its WAIT now
+    out_unpend(&c->p);
+    out_flush(&c->p);
+    timer_cancel(&s->wheel, &c->timer);
+
+    conn_detach(s, c);
+    c->partner = waiter;
+
+    head = atomic_load(&to->inbox);
+    do {
+        c->next = head;
+    } while(!atomic_compare_exchange_weak(&to->inbox, &head, c));
+
+    write(to->wake_fd, &one, sizeof(one));
+}
+
+// try to put our one leftover waiter where other shards can see it, or pair
+// it with a waiter another shard already put there
+static void lobby_offer(Shard *s) {
+    Conn *c = s->wait_head;
+    Conn *other;
+    Conn *expected = NULL;
+
+    if(s->nwaiting != 1 || c->published) return;
+
+    if(atomic_compare_exchange_strong(&lobby, &expected, c)) {
+        c->published = 1;
+        return;
+    }
+
+    other = atomic_exchange(&lobby, NULL);
+    if(other == NULL) return;   // next round will publish
+
+    queue_remove(s, c);
+    if(other->shard == s) {
+        // only our queue head is ever published, and c is that, so this never
+        // happens, but keep it playable
+        other->published = 0;
+        queue_remove(s, other);
+        if(game_start(s, other, c)) conn_pump(s, c);
+    } else {
+        // c's frames after OPEN are pumped once it is in the game over there
+        handoff(s, c, other->shard, other);
+    }
+}
+
+// a named player is ready for a match on this shard
+static void enqueue_player(Shard *s, Conn *c) {
+    c->state = CONN_WAITING;
+    c->fresh = 1;
+    c->since = now_ms();
+    queue_push(s, c);
+    conn_timer(s, c);
+    LOG(LOG_WAITING, .name = c->p.name);
+}
+
+// end of a loop round: the bot answers every move made against it this
+// round, handed to bot_plan in one call
+static void bot_turns(Shard *s) {
+    const Board *due[MAX_EVENTS];
+    BotMove moves[MAX_EVENTS];
+    int games[MAX_EVENTS];
+    int i, n, g, winner;
+    EvGame *game;
+    Board *board;
+
+    while(s->nbot_due > 0) {
+        // a game may have ended since it was queued, by forfeit or by its slot
+        // being freed and reused; only boards where the bot is to move count
+        n = 0;
+        while(s->nbot_due > 0 && n < MAX_EVENTS) {
+            g = s->bot_due[--s->nbot_due];
+            if(!s->gtab[g].active || s->gtab[g].bot != s->boards[g].turn) continue;
+            games[n] = g;
+            due[n++] = &s->boards[g];
+        }
+        bot_plan(due, n, moves);
+
+        for(i = 0; i < n; i++) {
+            g = games[i];
+            game = &s->gtab[g];
+            board = &s->boards[g];
+
+            board_take(board, moves[i].pile, moves[i].count);
+            game_moved(s, g, game->bot, moves[i].pile, moves[i].count);
+
+            winner = board_winner(board, game->bot);
+            if(winner != 0) {
+                send_over(board, game_player(game, 0), NULL, winner, (char *)"");
+                game_result(s, g, winner, 0);
+                game_end(s, g);
+                continue;
+            }
+
+            board->turn = 3 - game->bot;
+            broadcast_play(board, game_player(game, 0), NULL);
+            LOG(LOG_PLAY, .game = game->id, .board = board);
+            conn_timer(s, game->players[0]);
+        }
+    }
+}
+
+// end of a loop round: pair off everyone waiting here in arrival order
+static void match_waiting(Shard *s) {
+    Conn *a, *b;
+
+    while(s->nwaiting >= 2) {
+        // a published head may already be promised to another shard, which
+        // is sending it a partner
+        a = queue_pop(s);
+        if(!lobby_reclaim(a)) continue;
+        b = queue_pop(s);
+
+        a->fresh = b->fresh = 0;
+        if(game_start(s, a, b)) {
+            // moves sent along with OPEN are buffered, player 1 first
+            conn_pump(s, a);
+            conn_pump(s, b);
+        }
+    }
+
+    lobby_offer(s);
+
+    // whoever has waited past -B plays the bot, oldest first
+    while(bot_after_ms >= 0 && s->wait_head != NULL &&
+          now_ms() - s->wait_head->since >= bot_after_ms) {
+        a = queue_pop(s);
+        if(!lobby_reclaim(a)) continue;
+
+        a->fresh = 0;
+        if(game_start(s, a, NULL)) conn_pump(s, a);
+    }
+
+    // nobody to play this round, anything sent after OPEN is now an error
+    a = s->wait_head;
+    if(a != NULL && a->fresh) {
+        a->fresh = 0;
+        conn_pump(s, a);
+    }
+}
+
+// adopt connections other shards handed us
+static void drain_inbox(Shard *s) {
+    Conn *list = atomic_exchange(&s->inbox, NULL);
+    Conn *rev = NULL;
+    Conn *c, *w;
+    uint64_t count;
+
+    read(s->wake_fd, &count, sizeof(count));
+
+    // stack comes out newest first, restore arrival order
+    while(list != NULL) {
+        c = list;
+        list = c->next;
+        c->next = rev;
+        rev = c;
+    }
+
+    while(rev != NULL) {
+        c = rev;
+        rev = c->next;
+        w = c->partner;
+        c->partner = NULL;
+        c->next = NULL;
+
+        if(conn_attach(s, c) == -1) {
+            perror("conn_attach");
+            if(c->named) name_release(c->p.name);
+            close(c->p.fd);
+            out_release(&c->p.out);
+            free(c);
+            c = NULL;
+        } else if(c->p.out.head != c->p.out.tail) {
+            out_pend(&c->p);
+        }
+
+        if(w == NULL) {
+            if(c != NULL) resume_seat(s, c);
+            continue;
+        }
+
+        // the waiter was promised to c when it left the lobby
+        w->published = 0;
+        queue_remove(s, w);
+
+        // c may have sent more frames behind its OPEN
+        if(w->state == CONN_DEAD) {
+            free(w);
+            if(c != NULL) enqueue_player(s, c);
+        } else if(c != NULL) {
+            if(game_start(s, w, c)) conn_pump(s, c);
+        } else {
+            queue_push(s, w);
+        }
+    }
+}
+
+// each on_ handler returns 0 if c was closed or handed to another shard
+
+// c has the token for sess, send it where the game is
+static int on_resume(Shard *s, Conn *c, const Session *sess) {
+    c->token = sess->token;
+    c->game = sess->game;
+    c->id = sess->id;
+
+    if(s->parent != NULL) {
+        // fork mode: a worker process plays the game
+        if(!s->parent->resume(&c->p, sess)) {
+            send_fail(&c->p, FAIL_BUSY);
+            conn_close(c);
+            return 0;
+        }
+        conn_forget(c);
+        return 0;
+    }
+
+    if(sess->home != s->index) {
+        handoff(s, c, &shards[sess->home], NULL);
+        return 0;
+    }
+    return resume_seat(s, c);
+}
+
+static int on_open(Shard *s, Conn *c, const char *frame, int len) {
+    NgpMsg m;
+    Session sess;
+    int code;
+
+    c->p.opened = s->round_us;
+    code = parse_open(frame, len, &m);
+    if(code == 0) {
+        memcpy(c->p.name, m.name, m.name_len);
+        c->p.name[m.name_len] = '\0';
+        c->p.delta = m.delta;
+
+        // a token for a game still on goes back to it, a stale one is just
+        // an OPEN
+        if(m.token != NULL &&
+           name_resume(c->p.name, ngp_token(m.token, m.token_len), &sess)) {
+            return on_resume(s, c, &sess);
+        }
+        if(!name_claim(c->p.name)) {
+            code = FAIL_PLAYING;
+        }
+    }
+    if(code != 0) {
+        send_fail(&c->p, code);
+        conn_close(c);
+        return 0;
+    }
+
+    c->named = 1;
+    send_wait(&c->p);
+    metrics_reply(METRIC_OPEN_WAIT, c->p.opened);
+
+    // matched at the end of this round
+    enqueue_player(s, c);
+    return 1;
+}
+
+static int on_waiting(Shard *s, Conn *c, const char *frame, int len) {
+    send_fail(&c->p, waiting_fail(frame, len));
+    conn_close(c);
+    return 0;
+}
+
+// player leaves the game early, the opponent wins by forfeit
+static void forfeit(Shard *s, Conn *c) {
+    int g = c->game;
+    int id = c->id;
+
+    s->gtab[g].players[id - 1] = NULL;
+    conn_close(c);
+
+    send_over(&s->boards[g], game_player(&s->gtab[g], 2 - id), NULL, 3 - id,
+              (char *)"Forfeit");
+    game_result(s, g, 3 - id, 1);
+    game_end(s, g);
+}
+
+// the bot moves in g once this round's input is handled
+static void bot_due(Shard *s, int g) {
+    if(s->nbot_due == s->bot_cap) {
+        int cap = s->bot_cap ? s->bot_cap * 2 : 256;
+        int *grown = realloc(s->bot_due, cap * sizeof(*grown));
+
+        if(grown == NULL) {
+            perror("bot_due");
+            return;
+        }
+        s->bot_due = grown;
+        s->bot_cap = cap;
+    }
+    s->bot_due[s->nbot_due++] = g;
+}
+
+static int on_move(Shard *s, Conn *c, const char *frame, int len) {
+    int g = c->game;
+    EvGame *game = &s->gtab[g];
+    Board *board = &s->boards[g];
+    NgpMsg m;
+    int result, winner;
+
+    result = apply_message(board, &c->p, c->id, frame, len, &m);
+
+    if(result < 0) {
+        forfeit(s, c);
+        return 0;
+    }
+
+    if(result == 1) {
+        game_moved(s, g, c->id, m.pile, m.count);
+
+        winner = board_winner(board, c->id);
+        if(winner != 0) {
+            send_over(board, game_player(game, 0), game_player(game, 1), winner, (char *)"");
+            game_result(s, g, winner, 0);
+            game_end(s, g);
+            return 1;
+        }
+
+        board->turn = 3 - c->id;
+        broadcast_play(board, game_player(game, 0), game_player(game, 1));
+        metrics_reply(METRIC_MOVE_PLAY, s->round_us);
+        LOG(LOG_PLAY, .game = game->id, .board = board);
+        if(game->bot == board->turn) bot_due(s, g);
+
+        // the clock moves to whoever is up now
+        conn_timer(s, c);
+        if(game->players[2 - c->id] != NULL) conn_timer(s, game->players[2 - c->id]);
+    }
+    return 1;
+}
+
+// handle every complete frame buffered on a connection
+static void conn_pump(Shard *s, Conn *c) {
+    char scratch[NGP_MAX_FRAME];
+    const char *frame;
+    int n, alive = 1;
+
+    // a fresh waiter's frames stay buffered until this round's pairing is done
+    while(alive && !(c->state == CONN_WAITING && c->fresh) &&
+          (n = framer_next(&c->p.in, &frame, scratch)) != 0) {
+        if(n < 0) {
+            // not an NGP stream at all
+            if(c->state == CONN_CLOSING) {
+                c->p.in.head = c->p.in.tail;
+                return;
+            }
+            if(c->state == CONN_PLAYING) {
+                send_fail(&c->p, FAIL_INVALID);
+                forfeit(s, c);
+                return;
+            }
+            send_fail(&c->p, FAIL_INVALID);
+            conn_close(c);
+            return;
+        }
+
+        switch(c->state) {
+        case CONN_NEW:
+            alive = on_open(s, c, frame, n);
+            break;
+        case CONN_WAITING:
+            alive = on_waiting(s, c, frame, n);
+            break;
+        case CONN_PLAYING:
+            alive = on_move(s, c, frame, n);
+            break;
+        case CONN_CLOSING:
+            // game is over, ignore anything else the peer sends
+            break;
+        }
+    }
+}
+
+// a player dropped out of a game, their seat waits -R ms for them to OPEN
+// again with their token
+static void conn_hold(Shard *s, Conn *c) {
+    LOG(LOG_HELD, .game = s->gtab[c->game].id, .player = c->id, .name = c->p.name);
+
+    out_unpend(&c->p);
+    out_release(&c->p.out);
+    s->conns[c->p.fd] = NULL;
+    close(c->p.fd);
+    c->p.fd = -1;
+
+    c->state = CONN_HELD;
+    timer_arm(&s->wheel, &c->timer, s->wheel.now + resume_grace_ms);
+}
+
+static void on_readable(Shard *s, Conn *c) {
+    int n;
+
+    // never block here, a stale event may name a freshly reused fd
+    do {
+        n = framer_read(&c->p.in, c->p.fd, MSG_DONTWAIT);
+    } while(n < 0 && errno == EINTR);
+
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+
+    if(n <= 0) {
+        switch(c->state) {
+        case CONN_WAITING:
+            LOG(LOG_LEFT, .ms = now_ms() - c->since, .name = c->p.name,
+                .what = "state=waiting");
+            break;
+        case CONN_PLAYING:
+            if(resume_grace_ms > 0 && c->token != 0) {
+                conn_hold(s, c);
+                return;
+            }
+            LOG(LOG_LEFT, .game = s->gtab[c->game].id, .player = c->id, .name = c->p.name,
+                .what = "state=playing");
+            forfeit(s, c);
+            return;
+        }
+        conn_close(c);
+        return;
+    }
+
+    // a game that is over stays open for as long as the peer is active
+    if(c->state == CONN_CLOSING) conn_timer(s, c);
+    conn_pump(s, c);
+}
+
+// c's deadline passed
+static void conn_expire(Shard *s, Conn *c) {
+    switch(c->state) {
+    case CONN_NEW:
+        LOG(LOG_TIMED_OUT, .what = "state=new");
+        break;
+    case CONN_WAITING:
+        LOG(LOG_TIMED_OUT, .ms = now_ms() - c->since, .name = c->p.name,
+            .what = "state=waiting");
+        break;
+    case CONN_PLAYING:
+        // still connected, so unlike a disconnect both hear why it ended
+        LOG(LOG_TIMED_OUT, .ms = s->wheel.now - s->gtab[c->game].turn_at,
+            .game = s->gtab[c->game].id, .player = c->id, .name = c->p.name,
+            .what = "state=playing");
+        send_over(&s->boards[c->game], game_player(&s->gtab[c->game], 0),
+                  game_player(&s->gtab[c->game], 1), 3 - c->id, (char *)"Forfeit");
+        game_result(s, c->game, 3 - c->id, 1);
+        game_end(s, c->game);
+        return;
+    case CONN_HELD:
+        LOG(LOG_TIMED_OUT, .game = s->gtab[c->game].id, .player = c->id, .name = c->p.name,
+            .what = "state=held");
+        forfeit(s, c);
+        return;
+    }
+    conn_close(c);
+}
+
+// start the games the fork mode parent sent, each one a PoolJob with both
+// sockets attached, or the one socket of a player for the bot or of a player
+// coming back
+static void adopt_jobs(Shard *s) {
+    PoolJob job;
+    struct iovec iov;
+    struct msghdr mh;
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct cmsghdr *cm;
+    int fds[2];
+    Conn *c[2];
+    ssize_t n;
+    int i, nfds;
+
+    for(;;) {
+        iov.iov_base = &job;
+        iov.iov_len = sizeof(job);
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = sizeof(ctl.buf);
+
+        n = recvmsg(s->job_fd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            perror("recvmsg");
+            exit(1);
+        }
+        if(n == 0) exit(0);     // parent is gone
+
+        cm = CMSG_FIRSTHDR(&mh);
+        if(cm == NULL || cm->cmsg_type != SCM_RIGHTS ||
+           (cm->cmsg_len != CMSG_LEN(sizeof(int)) &&
+            cm->cmsg_len != CMSG_LEN(2 * sizeof(int)))) {
+            fprintf(stderr, "pool worker: job without sockets\n");
+            continue;
+        }
+        nfds = cm->cmsg_len == CMSG_LEN(sizeof(int)) ? 1 : 2;
+        memcpy(fds, CMSG_DATA(cm), nfds * sizeof(int));
+        if(n != sizeof(job) || nfds != (job.bot || job.resume ? 1 : 2) ||
+           job.game < 0 || job.game >= s->game_limit) {
+            fprintf(stderr, "pool worker: short job\n");
+            for(i = 0; i < nfds; i++) close(fds[i]);
+            continue;
+        }
+
+        c[1] = NULL;
+        for(i = 0; i < nfds; i++) {
+            fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+            c[i] = conn_add(s, fds[i]);
+            if(c[i] == NULL) continue;
+
+            // the parent still owns the name, it gets it back from job_done
+            strcpy(c[i]->p.name, job.name[i]);
+            c[i]->p.in = job.in[i];
+            c[i]->token = job.token[i];
+            c[i]->p.opened = job.opened[i];
+            c[i]->p.delta = job.delta[i];
+        }
+
+        if(job.resume) {
+            if(c[0] == NULL) {
+                perror("adopt_jobs");
+                close(fds[0]);
+                continue;
+            }
+            c[0]->game = s->job_games[job.game];
+            c[0]->id = job.resume;
+            resume_seat(s, c[0]);
+            continue;
+        }
+
+        if(c[0] == NULL || (nfds == 2 && c[1] == NULL)) {
+            perror("adopt_jobs");
+            for(i = 0; i < nfds; i++) {
+                if(c[i] != NULL) conn_close(c[i]);
+                else close(fds[i]);
+            }
+            job_done(s, job.game);
+            continue;
+        }
+
+        if(!game_start(s, c[0], c[1])) {
+            job_done(s, job.game);
+            continue;
+        }
+        s->gtab[c[0]->game].job = job.game;
+        s->job_games[job.game] = c[0]->game;
+
+        // moves sent along with OPEN are already buffered; pumping player 1
+        // can end the game but only ever frees player 1
+        conn_pump(s, c[0]);
+        if(c[1] != NULL) conn_pump(s, c[1]);
+    }
+}
+
+static void accept_all(Shard *s) {
+    int fd, one = 1;
+
+    for(;;) {
+        fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if(fd < 0) {
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) perror("accept failed");
+            return;
+        }
+
+        // each round's output already goes out in one write per client, and
+        // Nagle would hold a PLAY back for the ACK of the one before it
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        metrics_accept();
+        if(conn_add(s, fd) == NULL) {
+            perror("conn_add");
+            close(fd);
+        }
+    }
+}
+
+static int shard_init(Shard *s, const char *service) {
+    struct epoll_event ev;
+
+    s->free_head = -1;
+    s->job_fd = -1;
+    s->done_fd = -1;
+    s->listen_fd = -1;
+
+    if(service != NULL) {
+        s->listen_fd = open_listener(service, SOMAXCONN, nshards > 1);
+        if(s->listen_fd < 0) return -1;
+        fcntl(s->listen_fd, F_SETFL, fcntl(s->listen_fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    wheel_init(&s->wheel, now_ms());
+
+    s->wake_fd = eventfd(0, EFD_NONBLOCK);
+    s->epfd = epoll_create1(0);
+    if(s->wake_fd == -1 || s->epfd == -1) {
+        perror("epoll setup");
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = s->listen_fd;
+    if(s->listen_fd >= 0 && epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->listen_fd, &ev) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    ev.data.fd = s->wake_fd;
+    if(epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->wake_fd, &ev) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void *shard_run(void *arg) {
+    Shard *s = arg;
+    struct epoll_event events[MAX_EVENTS];
+    int n, i, timeout;
+    long long wait;
+    Timer *t;
+    cpu_set_t cpus;
+
+    metrics_attach(s->metrics_slot);
+
+    // one worker per core, the fork mode parent shares with them
+    if(s->parent == NULL) {
+        CPU_ZERO(&cpus);
+        CPU_SET(s->index % CPU_SETSIZE, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    while(1) {
+        // a waiter that could not be published yet polls the lobby
+        timeout = (s->nwaiting == 1 && !s->wait_head->published) ? LOBBY_RETRY_MS : -1;
+
+        // and the oldest waiter wakes the loop when it is the bot's turn
+        if(bot_after_ms >= 0 && s->wait_head != NULL) {
+            wait = s->wait_head->since + bot_after_ms - now_ms();
+            if(wait < 0) wait = 0;
+            if(timeout < 0 || wait < timeout) timeout = wait;
+        }
+
+        // and the nearest connection deadline
+        n = wheel_timeout(&s->wheel);
+        if(n >= 0 && (timeout < 0 || n < timeout)) timeout = n;
+
+        n = epoll_wait(s->epfd, events, MAX_EVENTS, timeout);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            perror("epoll_wait");
+            continue;
+        }
+
+        // deadlines armed this round count from now
+        wheel_advance(&s->wheel, now_ms());
+        s->round_us = metrics_now();
+
+        for(i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if(fd == s->listen_fd) {
+                accept_all(s);
+                continue;
+            }
+
+            if(fd == s->wake_fd) {
+                drain_inbox(s);
+                continue;
+            }
+
+            if(fd == s->job_fd) {
+                adopt_jobs(s);
+                continue;
+            }
+
+            if(s->parent != NULL && (fd == s->parent->fds[0] || fd == s->parent->fds[1])) {
+                s->parent->readable(fd);
+                continue;
+            }
+
+            // connection may have been closed by an earlier event this round
+            if(fd < s->conns_cap && s->conns[fd] != NULL &&
+               (events[i].events & ~EPOLLOUT)) {
+                on_readable(s, s->conns[fd]);
+            }
+            if(fd < s->conns_cap && s->conns[fd] != NULL &&
+               (events[i].events & EPOLLOUT)) {
+                conn_flush(s, s->conns[fd]);
+            }
+        }
+
+        // a deadline that came due is off if the connection moved on since
+        while((t = wheel_expired(&s->wheel)) != NULL) {
+            conn_expire(s, (Conn *)((char *)t - offsetof(Conn, timer)));
+        }
+
+        match_waiting(s);
+        bot_turns(s);
+        flush_pending(s);
+        metrics_round(s->active_games, s->nwaiting);
+    }
+
+    return NULL;
+}
+
+int event_main(const char *service, int max_games, int threads) {
+    pthread_t *tids;
+    int i;
+
+    nshards = threads;
+    shards = calloc(nshards, sizeof(*shards));
+    tids = calloc(nshards, sizeof(*tids));
+    if(shards == NULL || tids == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    for(i = 0; i < nshards; i++) {
+        shards[i].index = i;
+        shards[i].jring = i;
+        shards[i].metrics_slot = i;
+        shards[i].game_limit = (max_games + nshards - 1) / nshards;
+        if(shard_init(&shards[i], service) == -1) return 1;
+    }
+    if(journal_path != NULL && journal_open(nshards) == -1) return 1;
+
+    printf("Running games on %d event loop workers (max %d games each).\n",
+           nshards, shards[0].game_limit);
+    log_init();
+
+    for(i = 1; i < nshards; i++) {
+        if(pthread_create(&tids[i], NULL, shard_run, &shards[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    // the main thread is worker 0
+    shard_run(&shards[0]);
+    return 0;
+}
+
+// register a descriptor the shard loop should wake for
+static int shard_watch(Shard *s, int fd) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if(epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+// fork mode parent: one shard that accepts and matches players, handing
+// every pair to pp->start_game
+int event_parent(const char *service, PoolParent *pp) {
+    Shard *s;
+
+    nshards = 1;
+    shards = s = calloc(1, sizeof(*s));
+    if(s == NULL) {
+        perror("calloc");
+        return 1;
+    }
+    if(shard_init(s, service) == -1) return 1;
+
+    s->parent = pp;
+    log_init();
+    if(shard_watch(s, pp->fds[0]) == -1 || shard_watch(s, pp->fds[1]) == -1) return 1;
+
+    shard_run(s);
+    return 0;
+}
+
+// fork mode pool worker: one shard that plays every game the parent sends
+// over job_fd and reports each finished one on done_fd, runs until the
+// parent goes away
+int pool_worker(int index, int job_fd, int done_fd, int max_games) {
+    Shard s;
+
+    memset(&s, 0, sizeof(s));
+    nshards = 1;
+    shards = &s;
+    s.index = index;
+    s.metrics_slot = 1 + index;    // the parent counts in slot 0
+    s.game_limit = max_games;
+    if(shard_init(&s, NULL) == -1) return 1;
+
+    s.job_fd = job_fd;
+    s.done_fd = done_fd;
+    s.job_games = malloc(max_games * sizeof(*s.job_games));
+    if(s.job_games == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    memset(s.job_games, -1, max_games * sizeof(*s.job_games));
+    if(journal_path != NULL && journal_open(1) == -1) return 1;
+    log_init();
+    if(shard_watch(&s, job_fd) == -1) return 1;
+
+    shard_run(&s);
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include "nimd.h"
+
+// Fuzz target for the NGP exchange. An input is one control byte, then the
+// bytes of one connection, which ngp_session (proto.c) plays in process
+// against the bot. The control byte picks how the stream is cut up and what
+// the server is doing when it arrives:
+//   bits 0-1  chunk the Framer is fed at a time: 1, 7, 64 or 256 bytes
+//   bit 2     a frame arrives while the player waits for a match
+//   bit 3     the player is player 2
+//   bit 4     the server hands out tokens (-R), so OPEN may carry one
+// A stream may be either NGP version. Besides what the sanitizers catch,
+// every reply must be a whole frame of that version.
+//
+// With libFuzzer, or AFL++ through afl-clang-fast, which take the same entry:
+//   clang -g -O1 -fsanitize=fuzzer,address,undefined -pthread -o nimfuzz
+//       fuzz.c proto.c ngp.c board.c outq.c bot.c solve.c metrics.c
+//   ./nimfuzz corpus/
+// make nimfuzz builds the same target with gcc and a plain driver instead,
+// which runs the files it is given (or stdin, for AFL's @@) -n times each
+// and reports execs/s.
+
+static const int chunks[4] = { 1, 7, 64, 256 };
+
+// every byte queued for p must belong to a whole frame of the version p speaks
+static void check_replies(const Player *p) {
+    const Outq *q = &p->out;
+    unsigned int at = q->head, len, i;
+    char hdr[NGP_HDR_LEN];
+
+    while(at != q->tail) {
+        if(p->in.version == 1) {
+            if(q->tail - at < NGP1_HDR_LEN + 1) abort();
+            if(q->ring[at & (q->cap - 1)] != '1') abort();
+            len = (unsigned char)q->ring[(at + 1) & (q->cap - 1)];
+            if(len == 0 || q->tail - at < NGP1_HDR_LEN + len) abort();
+            at += NGP1_HDR_LEN + len;
+            continue;
+        }
+
+        if(q->tail - at < NGP_HDR_LEN) abort();
+        for(i = 0; i < NGP_HDR_LEN; i++) hdr[i] = q->ring[(at + i) & (q->cap - 1)];
+        if(hdr[0] != '0' || hdr[1] != '|' || hdr[4] != '|') abort();
+        if(hdr[2] < '0' || hdr[2] > '9' || hdr[3] < '0' || hdr[3] > '9') abort();
+
+        len = (hdr[2] - '0') * 10 + (hdr[3] - '0');
+        if(len == 0 || q->tail - at < NGP_HDR_LEN + len) abort();
+        at += NGP_HDR_LEN + len;
+        if(q->ring[(at - 1) & (q->cap - 1)] != '|') abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static int ready;
+    Player me;
+    int control;
+
+    if(!ready) {
+        board_configure(NULL, 0, 0);
+        ready = 1;
+    }
+    if(size == 0) return 0;
+
+    control = data[0];
+    resume_grace_ms = control & 16 ? 1000 : 0;
+
+    memset(&me, 0, sizeof(me));
+    me.fd = -1;
+    ngp_session(&me, (const char *)data + 1, (int)(size - 1), chunks[control & 3],
+                (control & 4 ? NGP_SESSION_WAIT : 0) | (control & 8 ? NGP_SESSION_SECOND : 0));
+    check_replies(&me);
+
+    out_unpend(&me);
+    out_release(&me.out);
+    return 0;
+}
+
+#ifdef FUZZ_MAIN
+static unsigned char *slurp(FILE *f, size_t *size) {
+    unsigned char *buf = NULL, *grown;
+    size_t cap = 0, n;
+
+    *size = 0;
+    for(;;) {
+        if(*size == cap) {
+            cap = cap ? cap * 2 : 4096;
+            grown = realloc(buf, cap);
+            if(grown == NULL) {
+                free(buf);
+                return NULL;
+            }
+            buf = grown;
+        }
+        n = fread(buf + *size, 1, cap - *size, f);
+        if(n == 0) break;
+        *size += n;
+    }
+    return buf;
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec t0, t1;
+    unsigned char **inputs;
+    size_t *sizes;
+    long rounds = 1, r, execs;
+    double secs;
+    int opt, i, n;
+    FILE *f;
+
+    while((opt = getopt(argc, argv, "n:")) != -1) {
+        switch(opt) {
+        case 'n':
+            rounds = atol(optarg);
+            if(rounds < 1) rounds = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n rounds] [input ...]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    n = argc > optind ? argc - optind : 1;
+    inputs = calloc(n, sizeof(*inputs));
+    sizes = calloc(n, sizeof(*sizes));
+    if(inputs == NULL || sizes == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    for(i = 0; i < n; i++) {
+        f = argc > optind ? fopen(argv[optind + i], "rb") : stdin;
+        if(f == NULL) {
+            perror(argv[optind + i]);
+            exit(1);
+        }
+        inputs[i] = slurp(f, &sizes[i]);
+        if(f != stdin) fclose(f);
+        if(inputs[i] == NULL) {
+            perror("read");
+            exit(1);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(r = 0; r < rounds; r++) {
+        for(i = 0; i < n; i++) LLVMFuzzerTestOneInput(inputs[i], sizes[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    execs = rounds * n;
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if(rounds > 1) {
+        printf("%ld execs in %.3fs, %.0f execs/s\n", execs, secs, secs > 0 ? execs / secs : 0);
+    }
+
+    for(i = 0; i < n; i++) free(inputs[i]);
+    free(inputs);
+    free(sizes);
+    return 0;
+}
+#endif
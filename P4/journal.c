@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "nimd.h"
+
+// Append-only game journal. Every game start, move and result is a binary
+// record, see nimd.h for the layout, appended to one file that any number of
+// event loop threads or pool worker processes share.
+//
+// Recording a record never waits for the disk: each event loop thread has
+// its own single-producer ring that the record is copied into, and a writer
+// thread collects what every ring holds every few milliseconds and appends
+// it with one writev, so the records of many games share a write and an
+// fsync (group commit). Records only ever enter a ring whole, so a batch
+// always ends on a record boundary, and O_APPEND keeps the batches of
+// several worker processes from overlapping.
+//
+// A full ring drops the record rather than stall the game, and counts it
+// (nimd_journal_dropped_total with -S). A game missing a record would replay
+// as invalid, so once one of its records is lost the game records nothing
+// more, and a LOST record naming it goes in as soon as the ring has room, so
+// nimreplay can tell a lost game from one that broke the rules.
+
+#define JOURNAL_RING_SIZE (1 << 20)     // bytes per thread, a power of two
+#define JOURNAL_BATCH_MS 5              // how often the writer collects
+
+typedef struct {
+    char *buf;
+    _Atomic unsigned int head;  // bytes the writer has taken
+    _Atomic unsigned int tail;  // bytes the producer has put in
+    unsigned int seq;           // games started from this ring
+    _Atomic unsigned long long records;
+    _Atomic unsigned long long dropped;
+    unsigned long long *lost;   // games waiting for their LOST record
+    int nlost, lost_cap;        // the producer's alone, like seq
+    char pad[64];               // keep the next ring's counters apart
+} JournalRing;
+
+const char *journal_path;
+int journal_fsync_ms = 100;
+
+static int journal_fd = -1;
+static JournalRing *rings;
+static int nrings;
+static unsigned int journal_id;     // high half of this process's game keys
+
+static _Atomic unsigned long long written_bytes;
+static _Atomic unsigned long long written_batches;
+static _Atomic unsigned long long syncs;
+
+static long long mono_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static unsigned char *put_u16(unsigned char *p, unsigned int v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static unsigned char *put_u32(unsigned char *p, unsigned int v) {
+    p = put_u16(p, v);
+    return put_u16(p, v >> 16);
+}
+
+static unsigned char *put_u64(unsigned char *p, unsigned long long v) {
+    p = put_u32(p, (unsigned int)v);
+    return put_u32(p, (unsigned int)(v >> 32));
+}
+
+// copy a whole record into ring, returns -1 if there is no room
+static int ring_copy(JournalRing *ring, const unsigned char *rec, unsigned int len) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned int at = tail & (JOURNAL_RING_SIZE - 1);
+    unsigned int first = JOURNAL_RING_SIZE - at;
+
+    if(JOURNAL_RING_SIZE - (tail - head) < len) return -1;
+
+    if(first >= len) {
+        memcpy(ring->buf + at, rec, len);
+    } else {
+        memcpy(ring->buf + at, rec, first);
+        memcpy(ring->buf, rec + first, len - first);
+    }
+    atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+    atomic_fetch_add_explicit(&ring->records, 1, memory_order_relaxed);
+    return 0;
+}
+
+// fill in the length now that the record ends at end and hand it to ring r,
+// after the LOST records still waiting for room; returns -1 if it was dropped
+static int ring_put(int r, unsigned char *rec, unsigned char *end) {
+    JournalRing *ring = &rings[r];
+    unsigned char lost[JOURNAL_LOST_LEN];
+
+    while(ring->nlost > 0) {
+        put_u16(lost, JOURNAL_LOST_LEN);
+        lost[2] = JOURNAL_LOST;
+        put_u64(lost + 3, ring->lost[ring->nlost - 1]);
+        if(ring_copy(ring, lost, JOURNAL_LOST_LEN) == -1) break;
+        ring->nlost--;
+    }
+
+    put_u16(rec, end - rec);
+    if(ring->nlost > 0 || ring_copy(ring, rec, end - rec) == -1) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        metrics_journal_drop();
+        return -1;
+    }
+    return 0;
+}
+
+// a record of *game did not fit: the game records nothing more, and is named
+// in a LOST record once there is room (if memory runs out it just looks
+// unfinished)
+static void game_lost(int r, unsigned long long *game) {
+    JournalRing *ring = &rings[r];
+    unsigned long long *grown;
+
+    if(ring->nlost == ring->lost_cap) {
+        grown = realloc(ring->lost, (ring->lost_cap * 2 + 64) * sizeof(*grown));
+        if(grown != NULL) {
+            ring->lost = grown;
+            ring->lost_cap = ring->lost_cap * 2 + 64;
+        }
+    }
+    if(ring->nlost < ring->lost_cap) ring->lost[ring->nlost++] = *game;
+    *game = 0;
+}
+
+// write every iovec out, a regular file may still take less than asked
+static int write_all(struct iovec *iov, int n) {
+    ssize_t done;
+
+    while(n > 0) {
+        done = writev(journal_fd, iov, n > IOV_MAX ? IOV_MAX : n);
+        if(done < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        while(n > 0 && (size_t)done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if(n > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return 0;
+}
+
+static void *journal_writer(void *arg) {
+    struct iovec *iov = calloc(2 * nrings, sizeof(*iov));
+    unsigned int *tails = calloc(nrings, sizeof(*tails));
+    struct timespec nap = { 0, JOURNAL_BATCH_MS * 1000000L };
+    long long last_sync = mono_ms();
+    unsigned long long batch, unsynced = 0;
+    unsigned int head, at, len, first;
+    int r, n;
+
+    (void)arg;
+    if(iov == NULL || tails == NULL) {
+        perror("journal");
+        return NULL;
+    }
+
+    for(;;) {
+        nanosleep(&nap, NULL);
+
+        // one writev takes whatever every ring has gathered since last time
+        n = 0;
+        batch = 0;
+        for(r = 0; r < nrings; r++) {
+            head = atomic_load_explicit(&rings[r].head, memory_order_relaxed);
+            tails[r] = atomic_load_explicit(&rings[r].tail, memory_order_acquire);
+            len = tails[r] - head;
+            if(len == 0) continue;
+
+            at = head & (JOURNAL_RING_SIZE - 1);
+            first = JOURNAL_RING_SIZE - at;
+            iov[n].iov_base = rings[r].buf + at;
+            iov[n++].iov_len = first < len ? first : len;
+            if(first < len) {
+                iov[n].iov_base = rings[r].buf;
+                iov[n++].iov_len = len - first;
+            }
+            batch += len;
+        }
+
+        if(n > 0) {
+            if(write_all(iov, n) == -1) perror("journal write");
+            for(r = 0; r < nrings; r++) {
+                atomic_store_explicit(&rings[r].head, tails[r], memory_order_release);
+            }
+            atomic_fetch_add_explicit(&written_bytes, batch, memory_order_relaxed);
+            atomic_fetch_add_explicit(&written_batches, 1, memory_order_relaxed);
+            unsynced += batch;
+        }
+
+        // -F 0 syncs every batch, otherwise at most once per interval
+        if(unsynced > 0 && mono_ms() - last_sync >= journal_fsync_ms) {
+            if(fdatasync(journal_fd) == -1) perror("journal fdatasync");
+            atomic_fetch_add_explicit(&syncs, 1, memory_order_relaxed);
+            last_sync = mono_ms();
+            unsynced = 0;
+        }
+    }
+    return NULL;
+}
+
+// create the journal at path if there is none, with its header, before any
+// process or thread that records to it starts; returns -1 on error
+int journal_create(const char *path) {
+    static const unsigned char header[JOURNAL_HDR_LEN] = JOURNAL_MAGIC;
+    struct stat st;
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+    if(fd == -1 || fstat(fd, &st) == -1) {
+        perror(path);
+        if(fd != -1) close(fd);
+        return -1;
+    }
+    if(st.st_size == 0 && write(fd, header, sizeof(header)) != sizeof(header)) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+// start recording to journal_path with one ring for each of n threads,
+// numbered 0 to n - 1; nothing is recorded while this has not run
+int journal_open(int n) {
+    pthread_t tid;
+    int r;
+
+    journal_fd = open(journal_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if(journal_fd == -1) {
+        perror(journal_path);
+        return -1;
+    }
+
+    rings = calloc(n, sizeof(*rings));
+    if(rings == NULL) return -1;
+    for(r = 0; r < n; r++) {
+        rings[r].buf = malloc(JOURNAL_RING_SIZE);
+        if(rings[r].buf == NULL) return -1;
+    }
+    nrings = n;
+
+    // game keys carry the process, so workers never hand out the same one
+    journal_id = (unsigned int)getpid() << 8;
+
+    if(pthread_create(&tid, NULL, journal_writer, NULL) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+// a new game on ring r: records who plays it under what rules and returns
+// the key its other records name it by, 0 if there is no journal or the
+// record was dropped
+unsigned long long journal_start(int r, const char *p1, const char *p2, int bot) {
+    unsigned char rec[JOURNAL_MAX_RECORD];
+    unsigned char *p = rec + 2;
+    unsigned long long game;
+    struct timespec ts;
+    int len;
+
+    if(rings == NULL) return 0;
+
+    game = (unsigned long long)(journal_id | (r & 0xff)) << 32 | ++rings[r].seq;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    *p++ = JOURNAL_START;
+    p = put_u64(p, game);
+    p = put_u64(p, ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+    *p++ = bot;
+    *p++ = rules.misere;
+    *p++ = rules.max_take > 255 ? 255 : rules.max_take;
+    *p++ = rules.npiles;
+    memcpy(p, rules.start, rules.npiles);
+    p += rules.npiles;
+
+    len = strlen(p1);
+    *p++ = len;
+    memcpy(p, p1, len);
+    p += len;
+    len = strlen(p2);
+    *p++ = len;
+    memcpy(p, p2, len);
+    p += len;
+
+    return ring_put(r, rec, p) == 0 ? game : 0;
+}
+
+// player took count from pile, ms after the game started; a dropped record
+// sets *game to 0, and a game of 0 records nothing
+void journal_move(int r, unsigned long long *game, unsigned int ms, int player, int pile,
+                  int count) {
+    unsigned char rec[JOURNAL_MOVE_LEN];
+    unsigned char *p = rec + 2;
+
+    if(rings == NULL || *game == 0) return;
+
+    *p++ = JOURNAL_MOVE;
+    p = put_u64(p, *game);
+    p = put_u32(p, ms);
+    *p++ = player;
+    *p++ = pile;
+    *p++ = count;
+    if(ring_put(r, rec, p) == -1) game_lost(r, game);
+}
+
+// the game ended ms after it started, won by winner, *game as for journal_move
+void journal_over(int r, unsigned long long *game, unsigned int ms, int winner, int forfeit) {
+    unsigned char rec[JOURNAL_OVER_LEN];
+    unsigned char *p = rec + 2;
+
+    if(rings == NULL || *game == 0) return;
+
+    *p++ = JOURNAL_OVER;
+    p = put_u64(p, *game);
+    p = put_u32(p, ms);
+    *p++ = winner;
+    *p++ = forfeit;
+    if(ring_put(r, rec, p) == -1) game_lost(r, game);
+}
+
+// what this process has recorded and written so far
+void journal_stats(JournalStats *st) {
+    int r;
+
+    memset(st, 0, sizeof(*st));
+    for(r = 0; r < nrings; r++) {
+        st->records += atomic_load_explicit(&rings[r].records, memory_order_relaxed);
+        st->dropped += atomic_load_explicit(&rings[r].dropped, memory_order_relaxed);
+    }
+    st->bytes = atomic_load_explicit(&written_bytes, memory_order_relaxed);
+    st->batches = atomic_load_explicit(&written_batches, memory_order_relaxed);
+    st->syncs = atomic_load_explicit(&syncs, memory_order_relaxed);
+}
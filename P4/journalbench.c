@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "nimd.h"
+
+// Benchmark for the game journal: threads stand in for event loop workers,
+// each playing many games at once (the bot plays both sides) and journaling
+// every start, move and result, while the journal's writer appends them with
+// the given fsync interval, at a target number of moves a second across all
+// threads (0 as fast as they go). Reports how many records a second made it
+// to the file and how many a full ring dropped. Run as
+// ./journalbench [file] [threads] [games_per_thread] [seconds] [fsync_ms] [moves_per_sec]
+
+#define BATCH 64    // moves made between looks at the clock
+
+static int games_per_thread = 2500;
+static double thread_rate;      // moves a second each thread makes, 0 no limit
+static atomic_int stop;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *player(void *arg) {
+    int r = (int)(long)arg;
+    Board *boards = calloc(games_per_thread, sizeof(*boards));
+    unsigned long long *keys = calloc(games_per_thread, sizeof(*keys));
+    const Board *one[1];
+    BotMove m;
+    unsigned int ms = 0;
+    int g = 0, i, mover;
+    long long made = 0;
+    double start = now(), ahead;
+
+    if(boards == NULL || keys == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    for(i = 0; i < games_per_thread; i++) {
+        board_init(&boards[i]);
+        keys[i] = journal_start(r, "bench1", "bench2", 0);
+    }
+
+    // a move in every game in turn, like a busy worker's rounds
+    while(!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        for(i = 0; i < BATCH; i++) {
+            one[0] = &boards[g];
+            bot_plan(one, 1, &m);
+            mover = boards[g].turn;
+            board_take(&boards[g], m.pile, m.count);
+            journal_move(r, &keys[g], ms, mover, m.pile, m.count);
+
+            if(board_winner(&boards[g], mover) != 0) {
+                journal_over(r, &keys[g], ms, board_winner(&boards[g], mover), 0);
+                board_init(&boards[g]);
+                keys[g] = journal_start(r, "bench1", "bench2", 0);
+            } else {
+                boards[g].turn = 3 - mover;
+            }
+            if(++g == games_per_thread) {
+                g = 0;
+                ms++;
+            }
+        }
+
+        // hold the pace
+        made += BATCH;
+        ahead = thread_rate > 0 ? made / thread_rate - (now() - start) : 0;
+        if(ahead > 0) {
+            struct timespec nap = { 0, (long)(ahead * 1e9) };
+
+            if(ahead < 1) nanosleep(&nap, NULL);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "journalbench.nimj";
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+    pthread_t *tids;
+    JournalStats st, prev;
+    double start, t;
+    int i;
+
+    if(argc > 3) games_per_thread = atoi(argv[3]);
+    if(argc > 5) journal_fsync_ms = atoi(argv[5]);
+    if(argc > 6) thread_rate = atof(argv[6]) / threads;
+    if(threads < 1 || games_per_thread < 1 || seconds < 1 || journal_fsync_ms < 0) {
+        fprintf(stderr, "Usage: %s [file] [threads] [games_per_thread] [seconds] [fsync_ms] "
+                        "[moves_per_sec]\n", argv[0]);
+        return 1;
+    }
+
+    remove(path);
+    journal_path = path;
+    if(journal_create(path) == -1 || journal_open(threads) == -1) return 1;
+
+    tids = calloc(threads, sizeof(*tids));
+    for(i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, player, (void *)(long)i);
+    }
+
+    printf("%d threads, %d games each, fsync every %d ms, %.0f moves/s each\n", threads,
+           games_per_thread, journal_fsync_ms, thread_rate);
+    memset(&prev, 0, sizeof(prev));
+    start = now();
+    for(i = 0; i < seconds; i++) {
+        struct timespec sec = { 1, 0 };
+
+        nanosleep(&sec, NULL);
+        journal_stats(&st);
+        printf("  %6.1f MB/s written, %9llu records/s, %9llu dropped, %4llu writes, %3llu syncs\n",
+               (st.bytes - prev.bytes) / 1e6, st.records - prev.records,
+               st.dropped - prev.dropped, st.batches - prev.batches, st.syncs - prev.syncs);
+        prev = st;
+    }
+    atomic_store(&stop, 1);
+    for(i = 0; i < threads; i++) pthread_join(tids[i], NULL);
+
+    // let the writer take what is left
+    struct timespec drain = { 0, 50 * 1000000L };
+    nanosleep(&drain, NULL);
+    journal_stats(&st);
+    t = now() - start;
+    printf("total: %llu records (%.1fM/s), %.1f MB written (%.1f MB/s), %llu dropped, "
+           "%llu writes, %llu syncs\n",
+           st.records, st.records / t / 1e6, st.bytes / 1e6, st.bytes / t / 1e6,
+           st.dropped, st.batches, st.syncs);
+    return 0;
+}
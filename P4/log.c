@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include "nimd.h"
+
+// Asynchronous structured log. A thread that logs copies the event's fields
+// into its own ring, which only it writes and only the drain thread reads,
+// so logging takes no lock and makes no syscall; the drain thread formats
+// what every ring holds as one "key=value" line per event and writes it out
+// in batches. A full ring drops the event and counts it, and the drain
+// thread reports the count. Events below the -L level are skipped by the LOG
+// macro before any field is even evaluated.
+
+#define LOG_RING_SIZE 4096      // events per thread, a power of two
+#define LOG_DRAIN_MS 10         // how often the drain thread looks
+#define LOG_BUF_SIZE (64 * 1024)
+#define LOG_LINE_MAX 1024       // longest line an event makes, names escaped
+
+typedef struct {
+    long long ts_ns;            // wall clock
+    long long ms;
+    unsigned long long game;
+    int event;
+    int player;
+    int a, b;
+    const char *what;
+    char name[MAX_NAME + 1];
+    char opp[MAX_NAME + 1];
+    Board board;
+    int has_board;
+} LogEntry;
+
+typedef struct LogRing {
+    LogEntry *entries;
+    _Atomic unsigned int head;  // entries the drain thread has taken
+    _Atomic unsigned int tail;  // entries the thread has put in
+    _Atomic unsigned long long dropped;
+    unsigned long long reported;    // drops the drain thread has told of
+    struct LogRing *next;
+} LogRing;
+
+static const char *event_names[] = {
+    [LOG_WAITING]     = "waiting",
+    [LOG_MATCHED]     = "matched",
+    [LOG_MOVED]       = "moved",
+    [LOG_PLAY]        = "play",
+    [LOG_OVER]        = "over",
+    [LOG_LEFT]        = "left",
+    [LOG_HELD]        = "held",
+    [LOG_RESUMED]     = "resumed",
+    [LOG_TIMED_OUT]   = "timed_out",
+    [LOG_NOT_READING] = "not_reading",
+};
+
+const unsigned char log_event_level[LOG_NEVENTS] = {
+    [LOG_WAITING]     = LOG_INFO,
+    [LOG_MATCHED]     = LOG_INFO,
+    [LOG_MOVED]       = LOG_DEBUG,
+    [LOG_PLAY]        = LOG_DEBUG,
+    [LOG_OVER]        = LOG_INFO,
+    [LOG_LEFT]        = LOG_INFO,
+    [LOG_HELD]        = LOG_INFO,
+    [LOG_RESUMED]     = LOG_INFO,
+    [LOG_TIMED_OUT]   = LOG_INFO,
+    [LOG_NOT_READING] = LOG_WARN,
+};
+
+static const char *level_names[] = { "debug", "info", "warn" };
+
+int log_level = LOG_INFO;
+
+static _Atomic(LogRing *) rings;
+static __thread LogRing *my_ring;
+static int drain_running;
+
+// this thread's ring, made on its first event
+static LogRing *ring_get(void) {
+    LogRing *r = my_ring;
+
+    if(r != NULL) return r;
+
+    r = calloc(1, sizeof(*r));
+    if(r == NULL) return NULL;
+    r->entries = malloc(LOG_RING_SIZE * sizeof(*r->entries));
+    if(r->entries == NULL) {
+        free(r);
+        return NULL;
+    }
+
+    r->next = atomic_load(&rings);
+    while(!atomic_compare_exchange_weak(&rings, &r->next, r));
+    my_ring = r;
+    return r;
+}
+
+static void copy_name(char *dst, const char *src) {
+    if(src == NULL) {
+        dst[0] = '\0';
+        return;
+    }
+    strncpy(dst, src, MAX_NAME);
+    dst[MAX_NAME] = '\0';
+}
+
+// record an event, only ever called through LOG
+void log_put(int event, const LogFields *f) {
+    LogRing *r = ring_get();
+    LogEntry *e;
+    struct timespec ts;
+    unsigned int tail;
+
+    if(r == NULL || !drain_running) return;
+
+    tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if(tail - atomic_load_explicit(&r->head, memory_order_acquire) == LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    e = &r->entries[tail & (LOG_RING_SIZE - 1)];
+    clock_gettime(CLOCK_REALTIME, &ts);
+    e->ts_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    e->event = event;
+    e->game = f->game;
+    e->player = f->player;
+    e->a = f->a;
+    e->b = f->b;
+    e->ms = f->ms;
+    e->what = f->what;
+    copy_name(e->name, f->name);
+    copy_name(e->opp, f->opp);
+    e->has_board = f->board != NULL;
+    if(e->has_board) e->board = *f->board;
+
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+// s as a quoted value: '"' and '\\' get a backslash and control bytes are
+// written \xHH, so a name can neither end the value nor start a new line
+static char *put_quoted(char *p, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char c;
+
+    *p++ = '"';
+    for(; (c = *s) != '\0'; s++) {
+        if(c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        } else if(c < 0x20 || c == 0x7f) {
+            *p++ = '\\';
+            *p++ = 'x';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 15];
+        } else {
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+// v in width digits, zero padded
+static char *put_digits(char *p, unsigned long long v, int width) {
+    int i;
+
+    for(i = width - 1; i >= 0; i--) {
+        p[i] = '0' + v % 10;
+        v /= 10;
+    }
+    return p + width;
+}
+
+// what every line starts with: the UTC time ts_ns to the microsecond, the
+// level and the event. The date is worked out here (Howard Hinnant's
+// days-to-civil) instead of by gmtime_r, which takes glibc's time zone
+// lock: the fork mode parent forks workers while this thread runs, and one
+// forked while the lock was held would wait on it for ever.
+static char *put_prefix(char *p, long long ts_ns, int level, const char *event) {
+    long long sec = ts_ns / 1000000000LL;
+    long long z = sec / 86400 + 719468;     // days since 0000-03-01
+    unsigned int tod = sec % 86400;
+    unsigned int doe, yoe, doy, mp, month;
+    long long year;
+
+    doe = z % 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = z / 146097 * 400 + yoe + (month <= 2);
+
+    p = put_digits(p, year, 4);
+    *p++ = '-';
+    p = put_digits(p, month, 2);
+    *p++ = '-';
+    p = put_digits(p, doy - (153 * mp + 2) / 5 + 1, 2);
+    *p++ = 'T';
+    p = put_digits(p, tod / 3600, 2);
+    *p++ = ':';
+    p = put_digits(p, tod / 60 % 60, 2);
+    *p++ = ':';
+    p = put_digits(p, tod % 60, 2);
+    *p++ = '.';
+    p = put_digits(p, ts_ns % 1000000000LL / 1000, 6);
+    p = stpcpy(p, "Z level=");
+    p = stpcpy(p, level_names[level]);
+    p = stpcpy(p, " event=");
+    return stpcpy(p, event);
+}
+
+// one line for e at p, which has room for LOG_LINE_MAX bytes
+static char *format(char *p, const LogEntry *e) {
+    p = put_prefix(p, e->ts_ns, log_event_level[e->event], event_names[e->event]);
+
+    if(e->game != 0) {
+        p += sprintf(p, " game=%u.%u", (unsigned int)(e->game >> 32), (unsigned int)e->game);
+    }
+    if(e->player != 0) p += sprintf(p, " player=%d", e->player);
+    if(e->name[0] != '\0') {
+        p += sprintf(p, " name=");
+        p = put_quoted(p, e->name);
+    }
+    if(e->opp[0] != '\0') {
+        p += sprintf(p, " opp=");
+        p = put_quoted(p, e->opp);
+    }
+
+    switch(e->event) {
+    case LOG_MOVED:
+        p += sprintf(p, " pile=%d count=%d", e->a, e->b);
+        break;
+    case LOG_OVER:
+        p += sprintf(p, " winner=%d", e->a);
+        break;
+    }
+    if(e->what != NULL) p += sprintf(p, " %s", e->what);
+    if(e->has_board) {
+        p += sprintf(p, " turn=%d board=\"", e->board.turn);
+        p = board_render(&e->board, p);
+        *p++ = '"';
+    }
+    if(e->ms >= 0) p += sprintf(p, " latency_ms=%lld", e->ms);
+    *p++ = '\n';
+    return p;
+}
+
+// write out whole lines, no more than PIPE_BUF bytes at a time: fork mode
+// workers share the descriptor, and a pipe only keeps a write that size in
+// one piece, so a bigger one can be split by another worker's
+static void drain_write(char *buf, char *end) {
+    char *p = buf, *cut;
+    ssize_t n;
+
+    while(p < end) {
+        cut = end;
+        if(end - p > PIPE_BUF) cut = (char *)memrchr(p, '\n', PIPE_BUF) + 1;
+        n = write(STDOUT_FILENO, p, cut - p);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        p += n;
+    }
+}
+
+static void *log_drain(void *arg) {
+    static char buf[LOG_BUF_SIZE];
+    struct timespec nap = { 0, LOG_DRAIN_MS * 1000000L };
+    unsigned long long dropped;
+    unsigned int head, tail;
+    struct timespec ts;
+    char *p = buf;
+    LogRing *r;
+
+    (void)arg;
+    for(;;) {
+        for(r = atomic_load(&rings); r != NULL; r = r->next) {
+            head = atomic_load_explicit(&r->head, memory_order_relaxed);
+            tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+            for(; head != tail; head++) {
+                if(buf + sizeof(buf) - p < LOG_LINE_MAX) {
+                    drain_write(buf, p);
+                    p = buf;
+                }
+                p = format(p, &r->entries[head & (LOG_RING_SIZE - 1)]);
+                atomic_store_explicit(&r->head, head + 1, memory_order_release);
+            }
+
+            dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+            if(dropped != r->reported && buf + sizeof(buf) - p >= LOG_LINE_MAX) {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                p = put_prefix(p, ts.tv_sec * 1000000000LL + ts.tv_nsec, LOG_WARN, "log_dropped");
+                p += sprintf(p, " count=%llu\n", dropped - r->reported);
+                r->reported = dropped;
+            }
+        }
+
+        // one write for everything this pass found
+        if(p != buf) {
+            drain_write(buf, p);
+            p = buf;
+        } else {
+            nanosleep(&nap, NULL);
+        }
+    }
+    return NULL;
+}
+
+// start the drain thread, once per process: in the server before the first
+// event, and again in each fork mode worker, which inherits no threads. The
+// fork mode parent goes on forking workers (to replace any that die) with
+// its drain thread running, which is why formatting takes no libc lock
+void log_init(void) {
+    pthread_t tid;
+
+    // anything printf left buffered goes out before the first event, and
+    // rings copied from the parent belong to threads this process lacks
+    fflush(stdout);
+    atomic_store(&rings, NULL);
+    my_ring = NULL;
+    drain_running = 0;
+
+    if(log_level >= LOG_OFF) return;
+    if(pthread_create(&tid, NULL, log_drain, NULL) != 0) {
+        perror("pthread_create");
+        return;
+    }
+    pthread_detach(tid);
+    drain_running = 1;
+}
+
+// level named by -L, -1 if there is none
+int log_parse_level(const char *name) {
+    int i;
+
+    for(i = 0; i < LOG_OFF; i++) {
+        if(strcmp(name, level_names[i]) == 0) return i;
+    }
+    return strcmp(name, "off") == 0 ? LOG_OFF : -1;
+}
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include "nimd.h"
+
+// Checks the structured log (log.c) the way fork mode uses it: several
+// processes, each with its own drain thread, write to one pipe that is read
+// slowly enough to fill up. Every line that comes out must parse as a whole
+// log line, and the events seen plus the drops reported must add up to what
+// was logged. Run as ./logtest, it exits 1 if a line is broken or missing.
+
+#define WRITERS 4
+#define EVENTS 20000        // per writer
+#define BURST 500           // events logged between naps
+#define TIMEOUT_MS 20000
+
+// log EVENTS moves with boards and awkward names, then wait to be killed
+static void writer(int w) {
+    struct timespec nap = { 0, 2000000L };
+    Board b;
+    char name[MAX_NAME + 1];
+    int i;
+
+    log_init();
+    board_init(&b);
+    for(i = 0; i < EVENTS; i++) {
+        snprintf(name, sizeof(name), "w%d \"quoted\" \\ \n%d", w, i);
+        b.turn = 1 + i % 2;
+        LOG(LOG_MOVED, .ms = i, .game = (unsigned long long)w << 32 | i, .player = b.turn,
+            .a = i % rules.npiles, .b = 1, .name = name, .opp = "opp", .board = &b);
+        if(i % BURST == BURST - 1) nanosleep(&nap, NULL);
+    }
+    for(;;) pause();
+}
+
+static int digits(const char *s, int n) {
+    int i;
+
+    for(i = 0; i < n; i++) {
+        if(s[i] < '0' || s[i] > '9') return 0;
+    }
+    return 1;
+}
+
+// a whole line, without its newline, parses: the timestamped prefix, then
+// key=value pairs whose values are bare or quoted with escapes
+static int parses(const char *s, int len) {
+    const char *end = s + len, *key;
+
+    if(len < 28 || !digits(s, 4) || s[4] != '-' || !digits(s + 5, 2) || s[7] != '-' ||
+       !digits(s + 8, 2) || s[10] != 'T' || !digits(s + 11, 2) || s[13] != ':' ||
+       !digits(s + 14, 2) || s[16] != ':' || !digits(s + 17, 2) || s[19] != '.' ||
+       !digits(s + 20, 6) || s[26] != 'Z') {
+        return 0;
+    }
+    s += 27;
+    if(strncmp(s, " level=", 7) != 0) return 0;
+
+    while(s < end) {
+        if(*s++ != ' ') return 0;
+        for(key = s; s < end && ((*s >= 'a' && *s <= 'z') || *s == '_'); s++);
+        if(s == key || s >= end || *s++ != '=') return 0;
+
+        if(s < end && *s == '"') {
+            for(s++; s < end && *s != '"'; s++) {
+                if((unsigned char)*s < 0x20) return 0;
+                if(*s == '\\') s++;
+            }
+            if(s++ >= end) return 0;
+        } else {
+            for(; s < end && *s != ' '; s++) {
+                if((unsigned char)*s < 0x20 || *s == '"') return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+int main(void) {
+    static char buf[64 * 1024];
+    struct timespec nap = { 0, 1000000L };
+    unsigned long long events = 0, dropped = 0, want = (unsigned long long)WRITERS * EVENTS;
+    long long lines = 0, bad = 0;
+    pid_t pids[WRITERS];
+    int fds[2], len = 0, n, w, waited = 0;
+    char *nl, *line, *count;
+
+    if(pipe(fds) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    log_level = LOG_DEBUG;
+    for(w = 0; w < WRITERS; w++) {
+        pids[w] = fork();
+        if(pids[w] == 0) {
+            dup2(fds[1], STDOUT_FILENO);
+            close(fds[0]);
+            writer(w);
+        }
+    }
+    close(fds[1]);
+
+    // read a little at a time so the pipe stays full and writes contend
+    while(events + dropped < want && waited < TIMEOUT_MS) {
+        if(poll(&(struct pollfd){ fds[0], POLLIN, 0 }, 1, 100) <= 0) {
+            waited += 100;
+            continue;
+        }
+        n = read(fds[0], buf + len, 512 < sizeof(buf) - len ? 512 : sizeof(buf) - len);
+        if(n <= 0) break;
+        len += n;
+        nanosleep(&nap, NULL);
+
+        line = buf;
+        while((nl = memchr(line, '\n', buf + len - line)) != NULL) {
+            lines++;
+            if(!parses(line, nl - line)) {
+                if(bad++ < 5) fprintf(stderr, "bad line: %.*s\n", (int)(nl - line), line);
+            } else if(memmem(line, nl - line, " event=moved ", 13) != NULL) {
+                events++;
+            } else if((count = memmem(line, nl - line, " event=log_dropped count=", 25)) != NULL) {
+                dropped += strtoull(count + 25, NULL, 10);
+            }
+            line = nl + 1;
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+        if(len == sizeof(buf)) break;   // a line that never ends
+    }
+
+    for(w = 0; w < WRITERS; w++) {
+        kill(pids[w], SIGKILL);
+        waitpid(pids[w], NULL, 0);
+    }
+
+    printf("Log: %s (%lld lines from %d processes, %llu events, %llu dropped, %lld bad)\n",
+           bad == 0 && events + dropped == want ? "PASS" : "FAIL", lines, WRITERS, events,
+           dropped, bad);
+    return bad == 0 && events + dropped == want ? 0 : 1;
+}
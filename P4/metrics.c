@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "nimd.h"
+
+// Live metrics for -S. Every event loop thread (and every fork mode worker
+// process) counts into its own slot, which only it writes, so counting takes
+// no lock and no atomic read-modify-write; a scrape of the metrics port adds
+// the slots up. The slots live in one shared mapping made before any worker
+// forks, so the parent sees its workers' counts too.
+//
+// Latencies go into log-linear histograms in the style of HdrHistogram: 8
+// buckets per power of two of microseconds, so any value is kept to within
+// 12.5%, in a fixed 2.5KB per histogram (the buckets are in nimd.h, nimbench
+// uses the same). A stage that ends with a reply
+// (OPEN to WAIT, second OPEN to NAME, MOVE to PLAY) starts when epoll said
+// the request was there and ends once the loop round has written the reply
+// to the socket, all of a round's replies timed by one clock read.
+
+#define MAX_FAIL 100
+#define PEND_MAX 1024       // replies timed per round, more are timed at once
+
+typedef struct {
+    _Atomic unsigned long long counts[HIST_BUCKETS];
+    _Atomic unsigned long long sum;     // us
+} Hist;
+
+typedef struct {
+    _Atomic unsigned long long accepts;
+    _Atomic unsigned long long fails[MAX_FAIL];
+    _Atomic unsigned long long journal_dropped;
+    _Atomic long long games;        // gauges, as of the slot's last round
+    _Atomic long long waiting;
+    Hist hist[METRIC_NSTAGES];
+} MetricsSlot;
+
+// a reply waiting for the round's flush to finish its stage
+typedef struct {
+    int stage;
+    long long since;
+} Pending;
+
+static MetricsSlot *slots;
+static int nslots;
+static int listen_fd = -1;
+
+static __thread MetricsSlot *mine;
+static __thread Pending pend[PEND_MAX];
+static __thread int npend;
+
+static const char *stage_names[METRIC_NSTAGES] = {
+    [METRIC_OPEN_WAIT] = "open_to_wait",
+    [METRIC_OPEN_NAME] = "open_to_name",
+    [METRIC_MOVE_PLAY] = "move_to_play",
+    [METRIC_GAME] = "game_duration",
+};
+
+// only the owning thread writes a counter, so a plain load and store will do
+static void bump(_Atomic unsigned long long *x, unsigned long long n) {
+    atomic_store_explicit(x, atomic_load_explicit(x, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static void hist_add(Hist *h, long long us) {
+    if(us < 0) us = 0;
+    bump(&h->counts[hist_bucket(us)], 1);
+    bump(&h->sum, us);
+}
+
+// microseconds on the monotonic clock, 0 without -S
+long long metrics_now(void) {
+    struct timespec ts;
+
+    if(mine == NULL) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// count into slot from this thread on
+void metrics_attach(int slot) {
+    if(slots != NULL && slot >= 0 && slot < nslots) mine = &slots[slot];
+}
+
+void metrics_accept(void) {
+    if(mine != NULL) bump(&mine->accepts, 1);
+}
+
+void metrics_fail(int code) {
+    if(mine != NULL && code >= 0 && code < MAX_FAIL) bump(&mine->fails[code], 1);
+}
+
+// a journal record this thread could not fit in its ring
+void metrics_journal_drop(void) {
+    if(mine != NULL) bump(&mine->journal_dropped, 1);
+}
+
+// a stage that took us microseconds
+void metrics_time(int stage, long long us) {
+    if(mine != NULL) hist_add(&mine->hist[stage], us);
+}
+
+// a stage that began at since ends when this round's replies are written
+void metrics_reply(int stage, long long since) {
+    if(mine == NULL) return;
+    if(npend == PEND_MAX) {
+        hist_add(&mine->hist[stage], metrics_now() - since);
+        return;
+    }
+    pend[npend].stage = stage;
+    pend[npend++].since = since;
+}
+
+// end of a loop round: the replies are written, and what the thread hosts
+void metrics_round(int games, int waiting) {
+    long long now;
+    int i;
+
+    if(mine == NULL) return;
+    if(npend > 0) {
+        now = metrics_now();
+        for(i = 0; i < npend; i++) hist_add(&mine->hist[pend[i].stage], now - pend[i].since);
+        npend = 0;
+    }
+    atomic_store_explicit(&mine->games, games, memory_order_relaxed);
+    atomic_store_explicit(&mine->waiting, waiting, memory_order_relaxed);
+}
+
+static unsigned long long sum_slots(size_t offset) {
+    unsigned long long total = 0;
+    int i;
+
+    for(i = 0; i < nslots; i++) {
+        total += atomic_load_explicit((_Atomic unsigned long long *)((char *)&slots[i] + offset),
+                                      memory_order_relaxed);
+    }
+    return total;
+}
+
+// one histogram in the exposition: cumulative buckets where the count
+// changes, then the sum, count and p50/p99/p999
+static char *print_hist(char *p, int stage) {
+    static const double quantiles[] = { 0.5, 0.99, 0.999 };
+    static const char *qnames[] = { "0.5", "0.99", "0.999" };
+    unsigned long long counts[HIST_BUCKETS];
+    unsigned long long total = 0, seen;
+    const char *name = stage_names[stage];
+    int b, q;
+
+    for(b = 0; b < HIST_BUCKETS; b++) {
+        counts[b] = sum_slots(offsetof(MetricsSlot, hist[stage].counts[b]));
+        total += counts[b];
+    }
+
+    p += sprintf(p, "# TYPE nimd_%s_seconds histogram\n", name);
+    seen = 0;
+    for(b = 0; b < HIST_BUCKETS; b++) {
+        if(counts[b] == 0) continue;
+        seen += counts[b];
+        p += sprintf(p, "nimd_%s_seconds_bucket{le=\"%.6f\"} %llu\n", name,
+                     (hist_top(b) + 1) / 1e6, seen);
+    }
+    p += sprintf(p, "nimd_%s_seconds_bucket{le=\"+Inf\"} %llu\n", name, total);
+    p += sprintf(p, "nimd_%s_seconds_sum %.6f\n", name,
+                 sum_slots(offsetof(MetricsSlot, hist[stage].sum)) / 1e6);
+    p += sprintf(p, "nimd_%s_seconds_count %llu\n", name, total);
+
+    for(q = 0; q < 3; q++) {
+        b = hist_quantile(counts, total, quantiles[q]);
+        p += sprintf(p, "nimd_%s_seconds_quantile{quantile=\"%s\"} %.6f\n", name, qnames[q],
+                     total > 0 ? hist_top(b) / 1e6 : 0.0);
+    }
+    return p;
+}
+
+// the whole exposition, into buf
+static int render(char *buf, double accept_rate) {
+    long long games = 0, waiting = 0;
+    unsigned long long n;
+    char *p = buf;
+    int i, stage;
+
+    for(i = 0; i < nslots; i++) {
+        games += atomic_load_explicit(&slots[i].games, memory_order_relaxed);
+        waiting += atomic_load_explicit(&slots[i].waiting, memory_order_relaxed);
+    }
+
+    p += sprintf(p, "# TYPE nimd_active_games gauge\nnimd_active_games %lld\n", games);
+    p += sprintf(p, "# TYPE nimd_waiting_players gauge\nnimd_waiting_players %lld\n", waiting);
+    p += sprintf(p, "# TYPE nimd_accepts_total counter\nnimd_accepts_total %llu\n",
+                 sum_slots(offsetof(MetricsSlot, accepts)));
+    p += sprintf(p, "# TYPE nimd_accepts_per_second gauge\nnimd_accepts_per_second %.1f\n",
+                 accept_rate);
+
+    p += sprintf(p, "# TYPE nimd_fails_total counter\n");
+    for(i = 0; i < MAX_FAIL; i++) {
+        n = sum_slots(offsetof(MetricsSlot, fails[i]));
+        if(n > 0) p += sprintf(p, "nimd_fails_total{code=\"%d\"} %llu\n", i, n);
+    }
+
+    p += sprintf(p, "# TYPE nimd_journal_dropped_total counter\nnimd_journal_dropped_total %llu\n",
+                 sum_slots(offsetof(MetricsSlot, journal_dropped)));
+
+    for(stage = 0; stage < METRIC_NSTAGES; stage++) p = print_hist(p, stage);
+    return p - buf;
+}
+
+static void write_all(int fd, const char *p, int len) {
+    ssize_t n;
+
+    while(len > 0) {
+        n = write(fd, p, len);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+// answers every connection to the metrics port with the exposition, as an
+// HTTP/1.0 response so a browser, curl or a Prometheus scraper can read it
+static void *metrics_serve(void *arg) {
+    static const char header[] = "HTTP/1.0 200 OK\r\n"
+                                 "Content-Type: text/plain; version=0.0.4\r\n\r\n";
+    // every bucket of every histogram at worst, and the rest
+    static char body[METRIC_NSTAGES * (HIST_BUCKETS + 8) * 96 + MAX_FAIL * 48 + 1024];
+    struct timeval wait = { 1, 0 };
+    struct timespec ts;
+    unsigned long long accepts, last_accepts = 0;
+    double now, last, rate;
+    char drain[512];
+    int fd, len;
+
+    // the first scrape's rate is since the server started
+    (void)arg;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    last = ts.tv_sec + ts.tv_nsec / 1e9;
+
+    for(;;) {
+        fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0) {
+            if(errno != EINTR) perror("metrics accept");
+            continue;
+        }
+
+        // accepts a second since the last scrape
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = ts.tv_sec + ts.tv_nsec / 1e9;
+        accepts = sum_slots(offsetof(MetricsSlot, accepts));
+        rate = now > last ? (accepts - last_accepts) / (now - last) : 0;
+        last = now;
+        last_accepts = accepts;
+
+        len = render(body, rate);
+        write_all(fd, header, sizeof(header) - 1);
+        write_all(fd, body, len);
+
+        // closing with the request unread would reset the connection
+        shutdown(fd, SHUT_WR);
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+        while(read(fd, drain, sizeof(drain)) > 0);
+        close(fd);
+    }
+    return NULL;
+}
+
+// make n counter slots and serve them on the listening socket fd, before
+// any thread that counts starts or any worker forks; returns -1 on error
+int metrics_open(int n, int fd) {
+    pthread_t tid;
+
+    if(fd < 0) return -1;
+    listen_fd = fd;
+
+    slots = mmap(NULL, n * sizeof(*slots), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(slots == MAP_FAILED) {
+        perror("mmap");
+        slots = NULL;
+        return -1;
+    }
+    nslots = n;
+
+    if(pthread_create(&tid, NULL, metrics_serve, NULL) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/random.h>
+#include "nimd.h"
+
+// Names of every player who is waiting or in a game, shared by all event loop
+// workers, or kept by the fork mode accept loop. Only OPEN and the end of a
+// connection touch it, never a MOVE.
+// An open addressing hash set with linear probing, so a lookup costs one hash
+// and usually one compare however many players are online.
+//
+// With -R a player in a game also has a session on their name: a random token
+// and where the game is. Whoever OPENs with the name and the token gets that
+// seat back, and the session goes when the name does.
+
+#define NAMES_MIN 1024  // initial slots, always a power of two
+
+typedef struct {
+    uint32_t hash;      // 0 marks an empty slot
+    char name[MAX_NAME + 1];
+    Session sess;       // token 0 while not in a game
+} NameSlot;
+
+static pthread_mutex_t names_lock = PTHREAD_MUTEX_INITIALIZER;
+static NameSlot *slots;
+static uint32_t names_mask;
+static uint32_t names_len;
+
+// FNV-1a, names are short so this beats anything with a setup cost
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;
+
+    while(*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h ? h : 1;
+}
+
+// slot holding name, or the empty slot where it would go
+static uint32_t name_find(const char *name, uint32_t h) {
+    uint32_t i = h & names_mask;
+
+    while(slots[i].hash != 0) {
+        if(slots[i].hash == h && strcmp(slots[i].name, name) == 0) break;
+        i = (i + 1) & names_mask;
+    }
+    return i;
+}
+
+// double the table once it is half full, returns -1 if out of memory
+static int names_grow(void) {
+    uint32_t cap = slots ? (names_mask + 1) * 2 : NAMES_MIN;
+    NameSlot *old = slots;
+    uint32_t old_cap = slots ? names_mask + 1 : 0;
+    uint32_t i;
+
+    slots = calloc(cap, sizeof(*slots));
+    if(slots == NULL) {
+        slots = old;
+        return -1;
+    }
+    names_mask = cap - 1;
+
+    for(i = 0; i < old_cap; i++) {
+        if(old[i].hash != 0) slots[name_find(old[i].name, old[i].hash)] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+// claim a name for a new player, returns 0 if someone already has it
+int name_claim(const char *name) {
+    uint32_t h = name_hash(name);
+    uint32_t i;
+
+    pthread_mutex_lock(&names_lock);
+
+    if((names_len + 1) * 2 > (slots ? names_mask + 1 : 0) && names_grow() == -1) {
+        pthread_mutex_unlock(&names_lock);
+        return 0;
+    }
+
+    i = name_find(name, h);
+    if(slots[i].hash != 0) {
+        pthread_mutex_unlock(&names_lock);
+        return 0;
+    }
+
+    slots[i].hash = h;
+    strcpy(slots[i].name, name);
+    memset(&slots[i].sess, 0, sizeof(slots[i].sess));
+    names_len++;
+    pthread_mutex_unlock(&names_lock);
+    return 1;
+}
+
+// give a name back once its player has left
+void name_release(const char *name) {
+    uint32_t h = name_hash(name);
+    uint32_t i, j, home;
+
+    pthread_mutex_lock(&names_lock);
+
+    if(slots == NULL || slots[i = name_find(name, h)].hash == 0) {
+        pthread_mutex_unlock(&names_lock);
+        return;
+    }
+
+    // shift later members of the probe run back so lookups never need
+    // tombstones; an entry moves into the hole unless its home slot lies
+    // cyclically after the hole
+    j = i;
+    for(;;) {
+        j = (j + 1) & names_mask;
+        if(slots[j].hash == 0) break;
+        home = slots[j].hash & names_mask;
+        if(i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+        slots[i] = slots[j];
+        i = j;
+    }
+    slots[i].hash = 0;
+    names_len--;
+
+    pthread_mutex_unlock(&names_lock);
+}
+
+// a token nobody can guess, never 0
+static unsigned long long new_token(void) {
+    static unsigned long long counter;
+    unsigned long long t = 0;
+    struct timespec ts;
+
+    if(getrandom(&t, sizeof(t), GRND_NONBLOCK) != sizeof(t)) {
+        // no entropy yet this early after boot, at least never repeat
+        clock_gettime(CLOCK_REALTIME, &ts);
+        t = (ts.tv_sec * 1000000000ULL + ts.tv_nsec) * 0x9e3779b97f4a7c15ULL + ++counter;
+    }
+    return t ? t : 1;
+}
+
+// a claimed name's player starts a game, returns the token they may come
+// back with, 0 if the name is not claimed
+unsigned long long name_session(const char *name, int home, int game, int id) {
+    uint32_t h = name_hash(name);
+    unsigned long long token = 0;
+    uint32_t i;
+
+    pthread_mutex_lock(&names_lock);
+    if(slots != NULL && slots[i = name_find(name, h)].hash != 0) {
+        token = new_token();
+        slots[i].sess.token = token;
+        slots[i].sess.home = home;
+        slots[i].sess.game = game;
+        slots[i].sess.id = id;
+    }
+    pthread_mutex_unlock(&names_lock);
+    return token;
+}
+
+// look up the game of a player coming back, returns 1 and fills in *sess if
+// name is in one and token is theirs
+int name_resume(const char *name, unsigned long long token, Session *sess) {
+    uint32_t h = name_hash(name);
+    uint32_t i;
+    int found = 0;
+
+    pthread_mutex_lock(&names_lock);
+    if(token != 0 && slots != NULL && slots[i = name_find(name, h)].hash != 0 &&
+       slots[i].sess.token == token) {
+        *sess = slots[i].sess;
+        found = 1;
+    }
+    pthread_mutex_unlock(&names_lock);
+    return found;
+}
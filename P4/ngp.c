@@ -0,0 +1,574 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "nimd.h"
+
+// NGP framing. A frame is "0|NN|" followed by exactly NN bytes of body, and
+// TCP is free to split or merge frames, so each connection buffers what it
+// has received in a small ring and frames are cut from it by their declared
+// length. A stream whose first byte is '1' is binary NGP v1 instead, where
+// the header is '1' and a length byte, and stays v1 to the end.
+
+#define FRAMER_MASK (FRAMER_SIZE - 1)
+
+static char framer_at(const Framer *f, unsigned int i) {
+    return f->ring[(f->head + i) & FRAMER_MASK];
+}
+
+// receive whatever fits in the ring, returns like recv()
+int framer_read(Framer *f, int fd, int flags) {
+    struct iovec iov[2];
+    struct msghdr mh;
+    unsigned int space = FRAMER_SIZE - (f->tail - f->head);
+    unsigned int at = f->tail & FRAMER_MASK;
+    unsigned int first = FRAMER_SIZE - at;
+    int n;
+
+    if(space == 0) {
+        // caller must consume frames first; a full ring can not hold a partial
+        errno = EAGAIN;
+        return -1;
+    }
+    if(first > space) first = space;
+
+    iov[0].iov_base = f->ring + at;
+    iov[0].iov_len = first;
+    iov[1].iov_base = f->ring;
+    iov[1].iov_len = space - first;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = space > first ? 2 : 1;
+
+    n = recvmsg(fd, &mh, flags);
+    if(n > 0) f->tail += n;
+    return n;
+}
+
+// take bytes that came some other way than a socket, as many as fit,
+// returns how many
+int framer_push(Framer *f, const char *bytes, int len) {
+    unsigned int space = FRAMER_SIZE - (f->tail - f->head);
+    unsigned int i;
+
+    if(len < 0) return 0;
+    if((unsigned int)len > space) len = space;
+    for(i = 0; i < (unsigned int)len; i++) {
+        f->ring[(f->tail + i) & FRAMER_MASK] = bytes[i];
+    }
+    f->tail += len;
+    return len;
+}
+
+// hand out the total bytes at the head of f as one frame
+static int framer_cut(Framer *f, unsigned int total, const char **frame, char *scratch) {
+    unsigned int at = f->head & FRAMER_MASK;
+    unsigned int i;
+
+    if(at + total <= FRAMER_SIZE) {
+        *frame = f->ring + at;
+    } else {
+        for(i = 0; i < total; i++) {
+            scratch[i] = framer_at(f, i);
+        }
+        *frame = scratch;
+    }
+    f->head += total;
+    return total;
+}
+
+// find the next complete frame, *frame points at it inside the ring, or at
+// scratch (NGP_MAX_FRAME bytes) when it wraps around the end of the ring;
+// the frame stays valid until the next framer_read
+// returns its length, 0 if more bytes are needed, -1 if the stream is not NGP
+int framer_next(Framer *f, const char **frame, char *scratch) {
+    unsigned int have = f->tail - f->head;
+    unsigned int len, total, i;
+    char c;
+
+    if(f->head == 0 && have > 0 && f->ring[0] == '1') f->version = 1;
+    if(f->version == 1) {
+        // '1' and a length that covers at least the type byte
+        if(have == 0) return 0;
+        if(framer_at(f, 0) != '1') return -1;
+        if(have < NGP1_HDR_LEN) return 0;
+        len = (unsigned char)framer_at(f, 1);
+        if(len == 0 || len > NGP_MAX_FRAME - NGP1_HDR_LEN) return -1;
+        total = NGP1_HDR_LEN + len;
+        if(have < total) return 0;
+        return framer_cut(f, total, frame, scratch);
+    }
+
+    // check the "0|NN|" header as far as it has arrived
+    for(i = 0; i < have && i < NGP_HDR_LEN; i++) {
+        c = framer_at(f, i);
+        switch(i) {
+        case 0:
+            if(c != '0') return -1;
+            break;
+        case 1:
+        case 4:
+            if(c != '|') return -1;
+            break;
+        default:
+            if(c < '0' || c > '9') return -1;
+        }
+    }
+    if(have < NGP_HDR_LEN) return 0;
+
+    len = (framer_at(f, 2) - '0') * 10 + (framer_at(f, 3) - '0');
+    total = NGP_HDR_LEN + len;
+    if(have < total) return 0;
+    return framer_cut(f, total, frame, scratch);
+}
+
+// Message parsing. One pass over the frame checks the header, looks the type
+// up in a table and reads the fields that type declares, leaving pointers
+// into the frame rather than copies.
+
+enum {
+    CH_OTHER,
+    CH_DIGIT,
+    CH_PIPE,
+    CH_MINUS
+};
+
+enum {
+    FIELD_NAME,
+    FIELD_INT,
+    FIELD_TOKEN,
+    FIELD_MODE      // "DELTA"
+};
+
+#define NGP_MAX_FIELDS 3
+#define TYPE_KEY(a, b, c, d) \
+    ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+
+static const struct {
+    uint32_t key;
+    int type;
+    int nfields;
+    int nrequired;      // the fields after these may be left out
+    unsigned char fields[NGP_MAX_FIELDS];
+} ngp_types[] = {
+    { TYPE_KEY('O', 'P', 'E', 'N'), NGP_OPEN, 3, 1, { FIELD_NAME, FIELD_TOKEN, FIELD_MODE } },
+    { TYPE_KEY('M', 'O', 'V', 'E'), NGP_MOVE, 2, 2, { FIELD_INT, FIELD_INT } },
+    { TYPE_KEY('S', 'Y', 'N', 'C'), NGP_SYNC, 0, 0, { 0 } },
+};
+
+#define NGP_NTYPES ((int)(sizeof(ngp_types) / sizeof(ngp_types[0])))
+
+static const unsigned char ch_class[256] = {
+    ['0'] = CH_DIGIT, ['1'] = CH_DIGIT, ['2'] = CH_DIGIT, ['3'] = CH_DIGIT,
+    ['4'] = CH_DIGIT, ['5'] = CH_DIGIT, ['6'] = CH_DIGIT, ['7'] = CH_DIGIT,
+    ['8'] = CH_DIGIT, ['9'] = CH_DIGIT, ['|'] = CH_PIPE, ['-'] = CH_MINUS,
+};
+
+// a v1 frame, whose fields are fixed bytes rather than text; a name must
+// still be one a v0 opponent can be sent
+static int ngp_parse_v1(const unsigned char *p, int len, NgpMsg *m) {
+    int n, i, rest;
+
+    if(len < NGP1_HDR_LEN + 1 || p[1] != len - NGP1_HDR_LEN) return FAIL_INVALID;
+
+    switch(p[2]) {
+    case NGP1_OPEN:
+        m->type = NGP_OPEN;
+        if(len < NGP1_HDR_LEN + 2) return FAIL_INVALID;
+        n = p[3];
+        if(n > MAX_NAME) return FAIL_LONG_NAME;
+
+        // after the name, a token or not and a flags byte or not
+        rest = len - (NGP1_HDR_LEN + 2 + n);
+        if(rest != 0 && rest != 1 && rest != 16 && rest != 17) return FAIL_INVALID;
+        for(i = 0; i < n; i++) {
+            if(p[4 + i] == '|' || p[4 + i] == '\0') return FAIL_INVALID;
+        }
+        m->name = (const char *)p + 4;
+        m->name_len = n;
+        if(rest >= 16) {
+            m->token = (const char *)p + 4 + n;
+            m->token_len = 16;
+        }
+        if(rest & 1) {
+            if(p[len - 1] & ~NGP_OPEN_DELTA) return FAIL_INVALID;
+            m->delta = p[len - 1] & NGP_OPEN_DELTA;
+        }
+        return 0;
+    case NGP1_MOVE:
+        m->type = NGP_MOVE;
+        if(len != NGP1_HDR_LEN + 3) return FAIL_INVALID;
+        m->pile = p[3];
+        m->count = p[4];
+        return 0;
+    case NGP1_SYNC:
+        m->type = NGP_SYNC;
+        return len == NGP1_HDR_LEN + 1 ? 0 : FAIL_INVALID;
+    }
+    return FAIL_INVALID;
+}
+
+// parse one whole frame of len bytes, of either version
+// returns 0 if it is well formed, otherwise the FAIL code; m->type is filled
+// in as soon as the type is known, even if a later field is bad
+int ngp_parse(const char *frame, int len, NgpMsg *m) {
+    const unsigned char *p = (const unsigned char *)frame;
+    const unsigned char *end = p + len;
+    const unsigned char *start;
+    uint32_t key;
+    int t, f, neg, value, digits;
+
+    m->type = NGP_NONE;
+    m->name = NULL;
+    m->name_len = 0;
+    m->token = NULL;
+    m->token_len = 0;
+    m->delta = 0;
+    m->pile = 0;
+    m->count = 0;
+
+    if(len > 0 && p[0] == '1') return ngp_parse_v1(p, len, m);
+
+    // header "0|NN|" whose length matches the frame, then "TYPE|"
+    if(len < NGP_HDR_LEN + 5 || p[0] != '0' || ch_class[p[1]] != CH_PIPE ||
+       ch_class[p[2]] != CH_DIGIT || ch_class[p[3]] != CH_DIGIT || ch_class[p[4]] != CH_PIPE ||
+       (p[2] - '0') * 10 + (p[3] - '0') != len - NGP_HDR_LEN || ch_class[p[9]] != CH_PIPE) {
+        return FAIL_INVALID;
+    }
+
+    key = TYPE_KEY(p[5], p[6], p[7], p[8]);
+    for(t = 0; t < NGP_NTYPES; t++) {
+        if(ngp_types[t].key == key) break;
+    }
+    if(t == NGP_NTYPES) return FAIL_INVALID;
+    m->type = ngp_types[t].type;
+
+    p += NGP_HDR_LEN + 5;
+    for(f = 0; f < ngp_types[t].nfields; f++) {
+        if(f >= ngp_types[t].nrequired && p == end) break;
+        start = p;
+
+        if(ngp_types[t].fields[f] == FIELD_NAME) {
+            while(p < end && ch_class[*p] != CH_PIPE) p++;
+            if(p - start > MAX_NAME) return FAIL_LONG_NAME;
+            if(p == end) return FAIL_INVALID;
+            m->name = (const char *)start;
+            m->name_len = p - start;
+        } else if(ngp_types[t].fields[f] == FIELD_TOKEN) {
+            // left empty when only the mode follows
+            while(p < end && ch_class[*p] != CH_PIPE) p++;
+            if(p == end) return FAIL_INVALID;
+            if(p > start) {
+                m->token = (const char *)start;
+                m->token_len = p - start;
+            }
+        } else if(ngp_types[t].fields[f] == FIELD_MODE) {
+            while(p < end && ch_class[*p] != CH_PIPE) p++;
+            if(p == end || p - start != 5 || memcmp(start, "DELTA", 5) != 0) return FAIL_INVALID;
+            m->delta = 1;
+        } else {
+            neg = 0;
+            value = 0;
+            digits = 0;
+            if(p < end && ch_class[*p] == CH_MINUS) {
+                neg = 1;
+                p++;
+            }
+            while(p < end && ch_class[*p] == CH_DIGIT) {
+                // saturate, anything this large is out of range anyway
+                if(value < 100000) value = value * 10 + (*p - '0');
+                digits++;
+                p++;
+            }
+            if(digits == 0 || p == end || ch_class[*p] != CH_PIPE) return FAIL_INVALID;
+            if(neg) value = -value;
+            if(f == 0) m->pile = value;
+            else m->count = value;
+        }
+
+        p++;    // the closing pipe
+    }
+
+    // nothing may follow the last field
+    if(p != end) return FAIL_INVALID;
+    return 0;
+}
+
+// the session token an OPEN carries, 16 hex digits as SESS sent them, 0 if
+// it is anything else
+unsigned long long ngp_token(const char *s, int len) {
+    unsigned long long v = 0;
+    int i, d;
+
+    if(len != 16) return 0;
+    for(i = 0; i < len; i++) {
+        if(s[i] >= '0' && s[i] <= '9') d = s[i] - '0';
+        else if(s[i] >= 'a' && s[i] <= 'f') d = s[i] - 'a' + 10;
+        else return 0;
+        v = v << 4 | d;
+    }
+    return v;
+}
+
+// Message encoding. A frame is written straight into the caller's buffer: the
+// body goes in behind room for the header, which is filled in last once the
+// length is known. Constant frames are never formatted at all.
+
+typedef struct {
+    const char *bytes;
+    int len;
+} StaticFrame;
+
+#define FRAME(s) { s, sizeof(s) - 1 }
+
+static const StaticFrame wait_frame = FRAME("0|05|WAIT|");
+
+static const StaticFrame fail_frames[FAIL_QUANTITY + 1] = {
+    [FAIL_INVALID]     = FRAME("0|16|FAIL|10|Invalid|"),
+    [FAIL_BUSY]        = FRAME("0|20|FAIL|20|Server Busy|"),
+    [FAIL_LONG_NAME]   = FRAME("0|18|FAIL|21|Long Name|"),
+    [FAIL_PLAYING]     = FRAME("0|24|FAIL|22|Already Playing|"),
+    [FAIL_OPEN]        = FRAME("0|21|FAIL|23|Already Open|"),
+    [FAIL_NOT_PLAYING] = FRAME("0|20|FAIL|24|Not Playing|"),
+    [FAIL_IMPATIENT]   = FRAME("0|18|FAIL|31|Impatient|"),
+    [FAIL_PILE]        = FRAME("0|19|FAIL|32|Pile Index|"),
+    [FAIL_QUANTITY]    = FRAME("0|17|FAIL|33|Quantity|"),
+};
+
+static const char wait_frame_v1[] = { '1', 1, NGP1_WAIT };
+
+#define FAIL_V1(code) [code] = { '1', 2, NGP1_FAIL, code }
+
+static const char fail_frames_v1[FAIL_QUANTITY + 1][4] = {
+    FAIL_V1(FAIL_INVALID), FAIL_V1(FAIL_BUSY), FAIL_V1(FAIL_LONG_NAME),
+    FAIL_V1(FAIL_PLAYING), FAIL_V1(FAIL_OPEN), FAIL_V1(FAIL_NOT_PLAYING),
+    FAIL_V1(FAIL_IMPATIENT), FAIL_V1(FAIL_PILE), FAIL_V1(FAIL_QUANTITY),
+};
+
+const char *ngp_wait_frame(int v, int *len) {
+    if(v == 1) {
+        *len = sizeof(wait_frame_v1);
+        return wait_frame_v1;
+    }
+    *len = wait_frame.len;
+    return wait_frame.bytes;
+}
+
+const char *ngp_fail_frame(int v, int code, int *len) {
+    if(code < 0 || code > FAIL_QUANTITY || fail_frames[code].bytes == NULL) {
+        code = FAIL_INVALID;
+    }
+    if(v == 1) {
+        *len = NGP1_HDR_LEN + 2;
+        return fail_frames_v1[code];
+    }
+    *len = fail_frames[code].len;
+    return fail_frames[code].bytes;
+}
+
+static char *put_str(char *p, const char *s) {
+    while(*s) *p++ = *s++;
+    return p;
+}
+
+// "TYPE|n|" where n is a single digit player number
+static char *put_type(char *p, const char *type, int n) {
+    p[0] = type[0];
+    p[1] = type[1];
+    p[2] = type[2];
+    p[3] = type[3];
+    p[4] = '|';
+    p[5] = '0' + n;
+    p[6] = '|';
+    return p + 7;
+}
+
+// fill in the "0|NN|" header now that the body ends at end
+static int finish(char *dst, char *end) {
+    int len = (int)(end - dst) - NGP_HDR_LEN;
+
+    dst[0] = '0';
+    dst[1] = '|';
+    dst[2] = '0' + len / 10;
+    dst[3] = '0' + len % 10;
+    dst[4] = '|';
+    return (int)(end - dst);
+}
+
+// a v1 frame's type byte, behind room for the header
+static char *put_type_v1(char *dst, int type) {
+    dst[NGP1_HDR_LEN] = type;
+    return dst + NGP1_HDR_LEN + 1;
+}
+
+// fill in the v1 header now that the frame ends at end
+static int finish_v1(char *dst, char *end) {
+    dst[0] = '1';
+    dst[1] = (char)(end - dst - NGP1_HDR_LEN);
+    return (int)(end - dst);
+}
+
+static char *put_hex(char *p, unsigned long long token) {
+    static const char hex[] = "0123456789abcdef";
+    int i;
+
+    for(i = 15; i >= 0; i--) *p++ = hex[(token >> (4 * i)) & 15];
+    return p;
+}
+
+// the piles as one byte each
+static char *put_piles(char *p, const Board *b) {
+    memcpy(p, b->piles, rules.npiles);
+    return p + rules.npiles;
+}
+
+int ngp_encode_name(char *dst, int v, int id, const char *name) {
+    char *p;
+
+    if(v == 1) {
+        p = put_type_v1(dst, NGP1_NAME);
+        *p++ = id;
+        p = put_str(p, name);
+        return finish_v1(dst, p);
+    }
+    p = put_type(dst + NGP_HDR_LEN, "NAME", id);
+    p = put_str(p, name);
+    *p++ = '|';
+    return finish(dst, p);
+}
+
+// "SESS|token|", the token a player OPENs with to get back into this game
+int ngp_encode_sess(char *dst, int v, unsigned long long token) {
+    char *p;
+
+    if(v == 1) {
+        p = put_hex(put_type_v1(dst, NGP1_SESS), token);
+        return finish_v1(dst, p);
+    }
+    p = dst + NGP_HDR_LEN;
+    memcpy(p, "SESS|", 5);
+    p = put_hex(p + 5, token);
+    *p++ = '|';
+    return finish(dst, p);
+}
+
+int ngp_encode_play(char *dst, int v, const Board *b) {
+    char *p;
+
+    if(v == 1) {
+        p = put_type_v1(dst, NGP1_PLAY);
+        *p++ = b->turn;
+        return finish_v1(dst, put_piles(p, b));
+    }
+    p = put_type(dst + NGP_HDR_LEN, "PLAY", b->turn);
+    p = board_render(b, p);
+    *p++ = '|';
+    return finish(dst, p);
+}
+
+// the big endian seq after the player to move, v1
+static char *put_seq_v1(char *p, const Board *b) {
+    *p++ = b->turn;
+    *p++ = b->seq >> 8;
+    *p++ = b->seq & 255;
+    return p;
+}
+
+// "SNAP|turn|seq|board|", the whole board for a player who gets DLTA
+int ngp_encode_snap(char *dst, int v, const Board *b) {
+    char *p;
+
+    if(v == 1) {
+        p = put_seq_v1(put_type_v1(dst, NGP1_SNAP), b);
+        return finish_v1(dst, put_piles(p, b));
+    }
+    p = put_type(dst + NGP_HDR_LEN, "SNAP", b->turn);
+    p = put_count(p, b->seq);
+    *p++ = '|';
+    p = board_render(b, p);
+    *p++ = '|';
+    return finish(dst, p);
+}
+
+// "DLTA|turn|seq|pile|count|", the pile the last move took from and what it
+// has left, in place of a PLAY
+int ngp_encode_delta(char *dst, int v, const Board *b) {
+    char *p;
+
+    if(v == 1) {
+        p = put_seq_v1(put_type_v1(dst, NGP1_DLTA), b);
+        *p++ = b->last;
+        *p++ = b->piles[b->last];
+        return finish_v1(dst, p);
+    }
+    p = put_type(dst + NGP_HDR_LEN, "DLTA", b->turn);
+    p = put_count(p, b->seq);
+    *p++ = '|';
+    p = put_count(p, b->last);
+    *p++ = '|';
+    p = put_count(p, b->piles[b->last]);
+    *p++ = '|';
+    return finish(dst, p);
+}
+
+// v1 only says whether there was a reason, which is always "Forfeit"
+int ngp_encode_over(char *dst, int v, const Board *b, int winner, const char *reason) {
+    char *p;
+
+    if(v == 1) {
+        p = put_type_v1(dst, NGP1_OVER);
+        *p++ = winner;
+        *p++ = reason[0] != '\0';
+        return finish_v1(dst, put_piles(p, b));
+    }
+    p = put_type(dst + NGP_HDR_LEN, "OVER", winner);
+    p = board_render(b, p);
+    *p++ = '|';
+    p = put_str(p, reason);
+    *p++ = '|';
+    return finish(dst, p);
+}
+
+// flags is 0 or NGP_OPEN_DELTA
+int ngp_encode_open(char *dst, int v, const char *name, int flags) {
+    char *p;
+    int n = strlen(name);
+
+    if(v == 1) {
+        p = put_type_v1(dst, NGP1_OPEN);
+        *p++ = n;
+        memcpy(p, name, n);
+        p += n;
+        if(flags) *p++ = flags;
+        return finish_v1(dst, p);
+    }
+    p = dst + NGP_HDR_LEN;
+    memcpy(p, "OPEN|", 5);
+    p = put_str(p + 5, name);
+    *p++ = '|';
+    if(flags & NGP_OPEN_DELTA) p = put_str(p, "|DELTA|");
+    return finish(dst, p);
+}
+
+int ngp_encode_move(char *dst, int v, int pile, int count) {
+    if(v == 1) {
+        dst[NGP1_HDR_LEN] = NGP1_MOVE;
+        dst[NGP1_HDR_LEN + 1] = pile;
+        dst[NGP1_HDR_LEN + 2] = count;
+        return finish_v1(dst, dst + NGP1_HDR_LEN + 3);
+    }
+    return finish(dst, dst + NGP_HDR_LEN + sprintf(dst + NGP_HDR_LEN, "MOVE|%d|%d|", pile, count));
+}
+
+int ngp_encode_sync(char *dst, int v) {
+    if(v == 1) {
+        dst[NGP1_HDR_LEN] = NGP1_SYNC;
+        return finish_v1(dst, dst + NGP1_HDR_LEN + 1);
+    }
+    memcpy(dst + NGP_HDR_LEN, "SYNC|", 5);
+    return finish(dst, dst + NGP_HDR_LEN + 5);
+}
@@ -0,0 +1,560 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netdb.h>
+#include "nimd.h"
+
+// Load generator for nimd. Threads each drive many simulated players over
+// non-blocking sockets from one epoll loop; every player connects, OPENs,
+// plays a full game to OVER with random or optimal (nim-sum) moves, and comes
+// back for another under a new name. Each second it reports games and moves
+// a second and the p50/p99/p999 of OPEN to NAME and of MOVE to the PLAY that
+// answers it, as the players saw them. With -r it ramps instead: every -d
+// seconds it doubles the players until a p99 goes past the -s SLO or the
+// server turns players away, and reports the most players that met the SLO.
+// With -1 the players speak binary NGP v1 instead of v0, with -D they ask for
+// DLTA updates and keep the board themselves. Run as
+// ./nimbench [-t threads] [-c players] [-d seconds] [-k max_take] [-o] [-1] [-D] [-r [-s slo_ms]] host port
+
+#define RAMP_MAX 65536      // most players a ramp goes to
+
+// where a simulated player is
+enum {
+    B_IDLE,         // not started yet
+    B_CONNECTING,
+    B_OPENED,       // sent OPEN, waiting for NAME
+    B_PLAYING
+};
+
+typedef struct {
+    int fd;
+    int state;
+    int id;             // 1 or 2 in its game
+    int moved;          // sent a MOVE, the next PLAY answers it
+    unsigned int gen;   // games played, part of the name
+    long long sent;     // us when the OPEN or the last MOVE went out
+    int piles[MAX_PILES];   // the board as last heard of
+    int npiles;
+    Framer in;
+} Bot;
+
+// latency histogram, bucketed like the server's (see nimd.h)
+typedef struct {
+    _Atomic unsigned long long counts[HIST_BUCKETS];
+} Hist;
+
+typedef struct {
+    _Atomic unsigned long long games;
+    _Atomic unsigned long long moves;
+    _Atomic unsigned long long fails;   // FAIL frames
+    _Atomic unsigned long long errors;  // connects refused, sockets closed early
+    _Atomic unsigned long long bytes;   // sent and received
+    Hist open_name;
+    Hist move_play;
+} Stats;
+
+typedef struct {
+    int index;
+    int epfd;
+    Bot *bots;
+    int nbots;          // started so far
+    int cap;
+    unsigned int seed;
+    Stats st;
+} Worker;
+
+static struct addrinfo *server;
+static Worker *workers;
+static int nthreads = 4;
+static int max_take;
+static int optimal;
+static int version;             // NGP version the players speak
+static int delta;               // NGP_OPEN_DELTA if they ask for DLTA
+static _Atomic int target;      // players across all threads
+
+static long long now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// only the worker's own thread writes its stats
+static void add(_Atomic unsigned long long *x, unsigned long long n) {
+    atomic_store_explicit(x, atomic_load_explicit(x, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static void bump(_Atomic unsigned long long *x) {
+    add(x, 1);
+}
+
+static void hist_add(Hist *h, long long us) {
+    bump(&h->counts[hist_bucket(us < 0 ? 0 : us)]);
+}
+
+// quantile q of counts, in ms
+static double quantile(const unsigned long long *counts, double q) {
+    unsigned long long total = 0;
+    int b;
+
+    for(b = 0; b < HIST_BUCKETS; b++) total += counts[b];
+    if(total == 0) return 0;
+    return hist_top(hist_quantile(counts, total, q)) / 1000.0;
+}
+
+// the piles in a v0 PLAY frame's board, returns how many
+static int read_piles(const char *board, int *piles) {
+    int n = 0;
+    char *end;
+
+    while(n < MAX_PILES && *board >= '0' && *board <= '9') {
+        piles[n++] = strtol(board, &end, 10);
+        board = *end == ' ' ? end + 1 : end;
+    }
+    return n;
+}
+
+// a move for the n piles, pile and count out
+static void choose_move(Worker *w, const int *piles, int n, int *pile, int *count) {
+    int i, x = 0, open = 0, take;
+
+    for(i = 0; i < n; i++) {
+        x ^= piles[i];
+        if(piles[i] > 0) open++;
+    }
+
+    // the nim-sum move when there is one, else a random one
+    if(optimal && x != 0) {
+        for(i = 0; i < n; i++) {
+            take = piles[i] - (piles[i] ^ x);
+            if(take > 0 && (max_take == 0 || take <= max_take)) {
+                *pile = i;
+                *count = take;
+                return;
+            }
+        }
+    }
+
+    open = open > 0 ? rand_r(&w->seed) % open : 0;
+    for(i = 0; i < n; i++) {
+        if(piles[i] > 0 && open-- == 0) break;
+    }
+    if(i == n) i = 0;
+    take = piles[i] < max_take || max_take == 0 ? piles[i] : max_take;
+    *pile = i;
+    *count = take > 0 ? 1 + rand_r(&w->seed) % take : 1;
+}
+
+static void bot_start(Worker *w, int i) {
+    Bot *b = &w->bots[i];
+    struct epoll_event ev;
+
+    memset(&b->in, 0, sizeof(b->in));
+    b->moved = 0;
+    b->npiles = 0;
+    b->fd = client_connect(server, SOCK_NONBLOCK);
+    if(b->fd < 0) {
+        bump(&w->st.errors);
+        b->state = B_IDLE;
+        return;
+    }
+
+    // writable once connected
+    b->state = B_CONNECTING;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.u32 = i;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, b->fd, &ev);
+}
+
+// the game is over or broke off, play another
+static void bot_restart(Worker *w, int i) {
+    Bot *b = &w->bots[i];
+
+    if(b->fd >= 0) close(b->fd);
+    b->fd = -1;
+    b->gen++;
+    bot_start(w, i);
+}
+
+// send a frame and count its bytes
+static void bot_send(Worker *w, Bot *b, const char *frame, int len) {
+    send_frame(b->fd, frame, len);
+    add(&w->st.bytes, len);
+}
+
+static void bot_connected(Worker *w, int i) {
+    Bot *b = &w->bots[i];
+    struct epoll_event ev;
+    char name[32], frame[NGP_MAX_FRAME];
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    getsockopt(b->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if(err != 0) {
+        bump(&w->st.errors);
+        bot_restart(w, i);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, b->fd, &ev);
+
+    snprintf(name, sizeof(name), "b%d_%d_%u", w->index, i, b->gen);
+    b->sent = now_us();
+    bot_send(w, b, frame, ngp_encode_open(frame, version, name, delta));
+    b->state = B_OPENED;
+}
+
+// what a server frame says, in either version
+enum {
+    F_OTHER,
+    F_NAME,
+    F_PLAY,
+    F_OVER,
+    F_FAIL
+};
+
+// the kind of frame, and for NAME the player number; a PLAY, SNAP or DLTA
+// gives the player to move and updates the piles, and is F_PLAY
+static int frame_kind(const char *frame, int len, int *who, int *piles, int *n) {
+    const unsigned char *p = (const unsigned char *)frame;
+    const char *type = frame + NGP_HDR_LEN;
+    const char *s;
+    char *end;
+    int i, pile;
+
+    if(p[0] == '1') {
+        if(len < NGP1_HDR_LEN + 1) return F_OTHER;
+        switch(p[2]) {
+        case NGP1_NAME:
+            *who = len > 3 ? p[3] : 0;
+            return F_NAME;
+        case NGP1_PLAY:
+        case NGP1_SNAP:
+            i = p[2] == NGP1_PLAY ? 4 : 6;
+            if(len < i) return F_OTHER;
+            *who = p[3];
+            *n = len - i > MAX_PILES ? MAX_PILES : len - i;
+            for(pile = 0; pile < *n; pile++) piles[pile] = p[i + pile];
+            return F_PLAY;
+        case NGP1_DLTA:
+            if(len != 8 || p[6] >= *n) return F_OTHER;
+            *who = p[3];
+            piles[p[6]] = p[7];
+            return F_PLAY;
+        case NGP1_OVER:
+            return F_OVER;
+        case NGP1_FAIL:
+            return F_FAIL;
+        }
+        return F_OTHER;
+    }
+
+    if(len < NGP_HDR_LEN + 7) return F_OTHER;
+    *who = type[5] - '0';
+    if(memcmp(type, "NAME|", 5) == 0) return F_NAME;
+    if(memcmp(type, "PLAY|", 5) == 0) {
+        *n = read_piles(type + 7, piles);
+        return F_PLAY;
+    }
+    if(memcmp(type, "SNAP|", 5) == 0 || memcmp(type, "DLTA|", 5) == 0) {
+        // the seq, then the board or pile and count
+        s = strchr(type + 7, '|');
+        if(s == NULL) return F_OTHER;
+        if(type[0] == 'S') {
+            *n = read_piles(s + 1, piles);
+            return F_PLAY;
+        }
+        pile = strtol(s + 1, &end, 10);
+        if(*end != '|' || pile < 0 || pile >= *n) return F_OTHER;
+        piles[pile] = strtol(end + 1, NULL, 10);
+        return F_PLAY;
+    }
+    if(memcmp(type, "OVER|", 5) == 0) return F_OVER;
+    if(memcmp(type, "FAIL|", 5) == 0) return F_FAIL;
+    return F_OTHER;
+}
+
+// handle one frame from the server, returns 0 if the player is done with
+// this connection
+static int bot_frame(Worker *w, Bot *b, const char *frame, int len) {
+    char move[NGP_MAX_FRAME];
+    int who = 0, pile, count;
+
+    switch(frame_kind(frame, len, &who, b->piles, &b->npiles)) {
+    case F_NAME:
+        hist_add(&w->st.open_name, now_us() - b->sent);
+        b->id = who;
+        b->state = B_PLAYING;
+        break;
+    case F_PLAY:
+        if(b->moved) {
+            hist_add(&w->st.move_play, now_us() - b->sent);
+            bump(&w->st.moves);
+            b->moved = 0;
+        }
+        if(who == b->id) {
+            choose_move(w, b->piles, b->npiles, &pile, &count);
+            b->sent = now_us();
+            bot_send(w, b, move, ngp_encode_move(move, version, pile, count));
+            b->moved = 1;
+        }
+        break;
+    case F_OVER:
+        // both players see it, the game counts once
+        if(b->moved) bump(&w->st.moves);
+        if(b->id == 1) bump(&w->st.games);
+        return 0;
+    case F_FAIL:
+        bump(&w->st.fails);
+        return 0;
+    }
+    // WAIT and SESS need nothing
+    return 1;
+}
+
+static void bot_readable(Worker *w, int i) {
+    Bot *b = &w->bots[i];
+    char scratch[NGP_MAX_FRAME];
+    const char *frame;
+    int n;
+
+    for(;;) {
+        n = framer_read(&b->in, b->fd, MSG_DONTWAIT);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if(n <= 0) {
+            bump(&w->st.errors);
+            bot_restart(w, i);
+            return;
+        }
+        add(&w->st.bytes, n);
+
+        while((n = framer_next(&b->in, &frame, scratch)) != 0) {
+            if(n < 0 || !bot_frame(w, b, frame, n)) {
+                if(n < 0) bump(&w->st.errors);
+                bot_restart(w, i);
+                return;
+            }
+        }
+    }
+}
+
+static void *worker_run(void *arg) {
+    Worker *w = arg;
+    struct epoll_event events[256];
+    int n, i, share;
+
+    for(;;) {
+        // this thread's part of the players, a ramp raises it as it goes
+        share = atomic_load(&target) / nthreads +
+                (w->index < atomic_load(&target) % nthreads);
+        if(share > w->cap) share = w->cap;
+        while(w->nbots < share) {
+            w->bots[w->nbots].fd = -1;
+            bot_start(w, w->nbots++);
+        }
+
+        n = epoll_wait(w->epfd, events, 256, 100);
+        for(i = 0; i < n; i++) {
+            Bot *b = &w->bots[events[i].data.u32];
+
+            if(b->state == B_CONNECTING) bot_connected(w, events[i].data.u32);
+            else bot_readable(w, events[i].data.u32);
+        }
+
+        // players whose connect failed outright try again
+        for(i = 0; i < w->nbots; i++) {
+            if(w->bots[i].state == B_IDLE) bot_start(w, i);
+        }
+    }
+    return NULL;
+}
+
+// everything the workers have counted so far
+static void snapshot(Stats *st) {
+    int t, b;
+
+    memset(st, 0, sizeof(*st));
+    for(t = 0; t < nthreads; t++) {
+        Stats *w = &workers[t].st;
+
+        st->games += atomic_load_explicit(&w->games, memory_order_relaxed);
+        st->moves += atomic_load_explicit(&w->moves, memory_order_relaxed);
+        st->fails += atomic_load_explicit(&w->fails, memory_order_relaxed);
+        st->errors += atomic_load_explicit(&w->errors, memory_order_relaxed);
+        st->bytes += atomic_load_explicit(&w->bytes, memory_order_relaxed);
+        for(b = 0; b < HIST_BUCKETS; b++) {
+            st->open_name.counts[b] +=
+                atomic_load_explicit(&w->open_name.counts[b], memory_order_relaxed);
+            st->move_play.counts[b] +=
+                atomic_load_explicit(&w->move_play.counts[b], memory_order_relaxed);
+        }
+    }
+}
+
+// what happened between snapshots a and b, as a report line; fills in the
+// p99s in ms
+static void report(const char *label, const Stats *a, const Stats *b, double secs,
+                   double *open_p99, double *move_p99) {
+    unsigned long long open[HIST_BUCKETS], move[HIST_BUCKETS];
+    unsigned long long moves = b->moves - a->moves;
+    int i;
+
+    for(i = 0; i < HIST_BUCKETS; i++) {
+        open[i] = b->open_name.counts[i] - a->open_name.counts[i];
+        move[i] = b->move_play.counts[i] - a->move_play.counts[i];
+    }
+    *open_p99 = quantile(open, 0.99);
+    *move_p99 = quantile(move, 0.99);
+
+    // bytes both ways per move, OPENs and all
+    printf("%s %8.0f games/s %9.0f moves/s %5.1f B/move  OPEN>NAME ms %6.2f %7.2f %7.2f  "
+           "MOVE>PLAY ms %6.2f %7.2f %7.2f  %llu fails %llu errors\n",
+           label, (b->games - a->games) / secs, moves / secs,
+           moves > 0 ? (double)(b->bytes - a->bytes) / moves : 0.0,
+           quantile(open, 0.5), *open_p99, quantile(open, 0.999),
+           quantile(move, 0.5), *move_p99, quantile(move, 0.999),
+           b->fails - a->fails, b->errors - a->errors);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-t threads] [-c players] [-d seconds] [-k max_take] [-o] [-1] [-D] "
+                    "[-r [-s slo_ms]] host port\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    static Stats first, prev, cur;
+    struct rlimit rl;
+    struct timespec sec = { 1, 0 };
+    pthread_t tid;
+    double open_p99, move_p99, slo_ms = 10;
+    int players = 0, seconds = 0, ramp = 0, best = 0;
+    int opt, t, i, cap;
+    char label[32];
+
+    while((opt = getopt(argc, argv, "t:c:d:k:o1Drs:")) != -1) {
+        switch(opt) {
+        case 't':
+            nthreads = atoi(optarg);
+            if(nthreads < 1) usage(argv[0]);
+            break;
+        case 'c':
+            players = atoi(optarg);
+            if(players < 2) usage(argv[0]);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            if(seconds < 1) usage(argv[0]);
+            break;
+        case 'k':
+            max_take = atoi(optarg);
+            if(max_take < 0) usage(argv[0]);
+            break;
+        case 'o':
+            optimal = 1;
+            break;
+        case '1':
+            version = 1;
+            break;
+        case 'D':
+            delta = NGP_OPEN_DELTA;
+            break;
+        case 'r':
+            ramp = 1;
+            break;
+        case 's':
+            slo_ms = atof(optarg);
+            if(slo_ms <= 0) usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if(optind != argc - 2) usage(argv[0]);
+
+    if(players == 0) players = ramp ? 100 : 1000;
+    if(seconds == 0) seconds = ramp ? 5 : 10;
+
+    server = client_resolve(argv[optind], argv[optind + 1]);
+    if(server == NULL) {
+        fprintf(stderr, "%s: can not resolve %s\n", argv[0], argv[optind]);
+        return 1;
+    }
+
+    // every player holds a socket
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    atomic_store(&target, players);
+    cap = ((ramp ? RAMP_MAX : players) + nthreads - 1) / nthreads;
+    workers = calloc(nthreads, sizeof(*workers));
+    for(t = 0; t < nthreads; t++) {
+        workers[t].index = t;
+        workers[t].seed = t + 1;
+        workers[t].cap = cap;
+        workers[t].bots = calloc(cap, sizeof(*workers[t].bots));
+        workers[t].epfd = epoll_create1(0);
+        if(workers[t].bots == NULL || workers[t].epfd == -1) {
+            perror("nimbench");
+            return 1;
+        }
+        pthread_create(&tid, NULL, worker_run, &workers[t]);
+    }
+
+    printf("%d players on %d threads, %s moves, NGP v%d%s\n", players, nthreads,
+           optimal ? "optimal" : "random", version, delta ? " with DLTA" : "");
+
+    if(!ramp) {
+        for(i = 1; i <= seconds; i++) {
+            nanosleep(&sec, NULL);
+            snapshot(&cur);
+            snprintf(label, sizeof(label), "%4ds", i);
+            report(label, &prev, &cur, 1, &open_p99, &move_p99);
+            prev = cur;
+        }
+        report("total", &first, &cur, seconds, &open_p99, &move_p99);
+        return 0;
+    }
+
+    // ramp: a step of -d seconds at each size, doubling while the p99s hold
+    printf("SLO: p99 of OPEN>NAME and MOVE>PLAY under %.1f ms\n", slo_ms);
+    for(;;) {
+        for(i = 0; i < seconds; i++) nanosleep(&sec, NULL);
+        snapshot(&cur);
+        snprintf(label, sizeof(label), "%6d", players);
+        report(label, &prev, &cur, seconds, &open_p99, &move_p99);
+
+        if(open_p99 > slo_ms || move_p99 > slo_ms || cur.fails > prev.fails ||
+           cur.games == prev.games) {
+            break;
+        }
+        best = players;
+        prev = cur;
+        if(players * 2 > RAMP_MAX) break;
+        players *= 2;
+        atomic_store(&target, players);
+
+        // let the new players get going before the step counts
+        nanosleep(&sec, NULL);
+        snapshot(&prev);
+    }
+    printf("most players within the SLO: %d\n", best);
+    return 0;
+}
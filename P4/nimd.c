@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,106 +15,296 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <netdb.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include "nimd.h"
 
-#define MAX_NAME 72
-#define BUF_SIZE 256
-#define MSG_BODY_SIZE 100 // message body length is at most 99
-#define MAX_GAMES 64 // max number of concurrent games
-
-// global piles for the Nim game
-int piles[5] = {1, 3, 5, 7, 9};
-
-typedef struct {
-    int fd;
-    char name[MAX_NAME + 1];
-} Player;
+#define MAX_GAMES 64 // default game limit in fork mode
+#define PID_SLOTS 128 // pid to worker map size, a power of two above 2 * workers
+#define MAX_WORKERS 64 // max number of game processes in fork mode
+#define EVENT_MAX_GAMES 100000 // default game limit for the event loop
 
 // track active games and which names are in them
 typedef struct {
-    pid_t pid;                  
+    int worker;                 // pool worker playing it
     char p1[MAX_NAME + 1];      
     char p2[MAX_NAME + 1];      
     int active;                 
+    int bot;                    // p1 plays the built-in bot, p2 is unused
+    int next_free;              // free list link while inactive
 } Game;
 
-// global array of games
-Game games[MAX_GAMES];
+// global array of games, -g long, with a free list of unused slots
+Game *games;
+static int games_len;
+static int games_free = -1;
 
-void play_game(Player p1, Player p2);
-int handle_message(Player *me, Player *opp, int *turn, int my_id);
-void send_fail(int fd, char *code, char *msg, int close_conn);
-void send_over(int fd1, int fd2, int winner, char *reason);
-void broadcast_play(int fd1, int fd2, int next_player);
-void sigchld_handler(int s);
+// pre-forked game processes, each plays many games at once
+typedef struct {
+    pid_t pid;
+    int fd;         // our end of its job socket
+    int games;      // games it is playing
+} Worker;
 
-// main server program
-int main(int argc, char *argv[]) {
-    int new_socket;
-    int port;
+static Worker workers[MAX_WORKERS];
+static int nworkers;
+
+// every worker reports finished games on one datagram socket
+static int done_fds[2];
+static int sig_fd;
+
+// worker index of each running child, open addressing on the pid
+static pid_t pid_keys[PID_SLOTS];
+static int pid_workers[PID_SLOTS];
+
+static void reap_workers(void);
 
-    char buf[BUF_SIZE];
-    char *ptr;
-    int pipes_count;
-    char *name_start;
-    char *name_end;
-    int valread;
+static void pid_insert(pid_t pid, int worker) {
+    unsigned int i = (unsigned int)pid & (PID_SLOTS - 1);
+
+    while(pid_keys[i] != 0) i = (i + 1) & (PID_SLOTS - 1);
+    pid_keys[i] = pid;
+    pid_workers[i] = worker;
+}
+
+// take a child out of the map, returns its worker index or -1 if unknown
+static int pid_remove(pid_t pid) {
+    unsigned int i = (unsigned int)pid & (PID_SLOTS - 1);
+    unsigned int j, home;
+    int worker;
+
+    while(pid_keys[i] != pid) {
+        if(pid_keys[i] == 0) return -1;
+        i = (i + 1) & (PID_SLOTS - 1);
+    }
+    worker = pid_workers[i];
+
+    // shift the rest of the probe run back over the hole
+    j = i;
+    for(;;) {
+        j = (j + 1) & (PID_SLOTS - 1);
+        if(pid_keys[j] == 0) break;
+        home = (unsigned int)pid_keys[j] & (PID_SLOTS - 1);
+        if(i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+        pid_keys[i] = pid_keys[j];
+        pid_workers[i] = pid_workers[j];
+        i = j;
+    }
+    pid_keys[i] = 0;
+    return worker;
+}
+
+// start game process w, it keeps only stdio, its end of the job socket and
+// the done socket
+static int spawn_worker(int w) {
+    int sv[2];
+    int done;
+    pid_t pid;
+
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1) {
+        perror("socketpair");
+        return -1;
+    }
 
-    Player waiting_player;
-    int waiting = 0;     // 0 means nobody waiting, 1 means one player waiting
-    int pid;
+    // the child must not print what we have buffered
+    fflush(stdout);
+    pid = fork();
+    if(pid == 0) {
+        // a respawned worker would otherwise hold every socket the parent
+        // has, so move what it needs to fds 3 and 4 and close the rest
+        done = done_fds[1] == 3 ? dup(done_fds[1]) : done_fds[1];
+        if(sv[1] != 3) dup2(sv[1], 3);
+        if(done != 4) dup2(done, 4);
+        close_range(5, ~0U, 0);
+        exit(pool_worker(w, 3, 4, games_len));
+    }
 
-    struct pollfd pollfds[2]; // poll array for server and waiting player
-    int nfds;                 // number of fds to poll
-    int activity;
+    close(sv[1]);
+    if(pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        workers[w].fd = -1;
+        return -1;
+    }
 
-    const char wait_msg[] = "0|05|WAIT|";
+    workers[w].pid = pid;
+    workers[w].fd = sv[0];
+    workers[w].games = 0;
+    pid_insert(pid, w);
+    return 0;
+}
 
+// worker with the fewest games, -1 if none is running
+static int least_busy(void) {
+    int w = -1;
     int i;
 
-    // initialize games array
-    for(i = 0; i < MAX_GAMES; i++) {
-        games[i].active = 0;
-        games[i].pid = 0;
-        games[i].p1[0] = '\0';
-        games[i].p2[0] = '\0';
+    for(i = 0; i < nworkers; i++) {
+        if(workers[i].fd >= 0 && (w == -1 || workers[i].games < workers[w].games)) w = i;
     }
+    return w;
+}
 
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = sigchld_handler;
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+// send worker w a job with its nfds sockets, returns 0 or -1 if it failed
+static int pool_send(int w, PoolJob *job, int *fds, int nfds) {
+    struct iovec iov;
+    struct msghdr mh;
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct cmsghdr *cm;
+    ssize_t n;
+
+    iov.iov_base = job;
+    iov.iov_len = sizeof(*job);
+    memset(&mh, 0, sizeof(mh));
+    memset(&ctl, 0, sizeof(ctl));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
 
-    if(sigaction(SIGCHLD, &sa, NULL) == -1) {
-        perror("sigaction SIGCHLD failed");
-        exit(1);
+    do {
+        n = sendmsg(workers[w].fd, &mh, 0);
+    } while(n < 0 && errno == EINTR);
+    if(n != sizeof(*job)) {
+        perror("sendmsg");
+        return -1;
     }
+    return 0;
+}
 
-    struct sigaction sa_pipe;
-    memset(&sa_pipe, 0, sizeof(sa_pipe));
-    sa_pipe.sa_handler = SIG_IGN;
-    if(sigaction(SIGPIPE, &sa_pipe, NULL) == -1) {
-        perror("sigaction SIGPIPE failed");
-        exit(1);
+// a game is over, free its slot and give back its names
+static void finish_game(int g) {
+    name_release(games[g].p1);
+    if(!games[g].bot) name_release(games[g].p2);
+    workers[games[g].worker].games--;
+    games[g].active = 0;
+    games[g].p1[0] = '\0';
+    games[g].p2[0] = '\0';
+    games[g].next_free = games_free;
+    games_free = g;
+}
+
+// read the slots of games the workers have finished
+static void read_done(void) {
+    int g;
+
+    while(recv(done_fds[0], &g, sizeof(g), MSG_DONTWAIT) == sizeof(g)) {
+        if(g >= 0 && g < games_len && games[g].active) finish_game(g);
     }
+}
 
-    if(argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-        exit(1);
+// a pair was matched, or a player with the bot when b is NULL, a worker
+// process plays their game; returns 0 if there is no room, the event loop then turns them away
+static int start_game(Player *a, Player *b) {
+    PoolJob job;
+    int fds[2] = { a->fd, b ? b->fd : -1 };
+    int g, w;
+
+    g = games_free;
+    w = least_busy();
+    if(g == -1 || w == -1) return 0;
+
+    memset(&job, 0, sizeof(job));
+    job.game = g;
+    job.bot = b == NULL;
+    strcpy(job.name[0], a->name);
+    job.in[0] = a->in;
+    job.opened[0] = a->opened;
+    job.delta[0] = a->delta;
+    if(b != NULL) {
+        strcpy(job.name[1], b->name);
+        job.in[1] = b->in;
+        job.opened[1] = b->opened;
+        job.delta[1] = b->delta;
+    }
+
+    // the sessions live with the names here, the worker only passes the
+    // tokens on
+    if(resume_grace_ms > 0) {
+        job.token[0] = name_session(a->name, w, g, 1);
+        if(b != NULL) job.token[1] = name_session(b->name, w, g, 2);
+    }
+
+    if(pool_send(w, &job, fds, b ? 2 : 1) == -1) return 0;
+    workers[w].games++;
+
+    // the names stay claimed until the worker reports the game over
+    games_free = games[g].next_free;
+    games[g].active = 1;
+    games[g].worker = w;
+    strcpy(games[g].p1, a->name);
+    games[g].bot = b == NULL;
+    if(b != NULL) strcpy(games[g].p2, b->name);
+    return 1;
+}
+
+// a player came back for their game, the socket goes to the worker playing
+// it; returns 0 if that worker is gone
+static int resume_game(Player *p, const Session *sess) {
+    PoolJob job;
+
+    if(!games[sess->game].active || games[sess->game].worker != sess->home ||
+       workers[sess->home].fd < 0) {
+        return 0;
     }
 
-    port = atoi(argv[1]);
+    memset(&job, 0, sizeof(job));
+    job.game = sess->game;
+    job.resume = sess->id;
+    strcpy(job.name[0], p->name);
+    job.in[0] = p->in;
+    job.delta[0] = p->delta;
+    job.token[0] = sess->token;
+    return pool_send(sess->home, &job, &p->fd, 1) == 0;
+}
+
+static void parent_readable(int fd) {
+    if(fd == sig_fd) reap_workers();
+    else read_done();
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-m fork|event] [-g max_games] [-t workers] [-p piles] [-M] [-k max_take] [-B bot_ms]\n"
+                    "       [-O open_ms] [-T turn_ms] [-I idle_ms] [-R resume_ms] [-J journal [-F fsync_ms]]\n"
+                    "       [-L debug|info|warn|off] [-S metrics_port] <port>\n", prog);
+    exit(1);
+}
 
+// raise the open file limit as far as we are allowed, the event loop keeps
+// every client socket open in one process
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// bind and listen on the given port, reuseport lets several event loop
+// workers each own a listening socket on the same port
+int open_listener(const char *service, int backlog, int reuseport) {
     struct addrinfo hints, *servinfo, *info;
     int rv;
     int server_fd;
+    int one = 1;
     memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_UNSPEC;     
     hints.ai_socktype = SOCK_STREAM; 
     hints.ai_flags = AI_PASSIVE;     
 
-    if((rv = getaddrinfo(NULL, argv[1], &hints, &servinfo)) != 0) {
+    if((rv = getaddrinfo(NULL, service, &hints, &servinfo)) != 0) {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
-        return 1;
+        return -1;
     }
 
     for(info = servinfo; info != NULL; info = info->ai_next) {
@@ -122,6 +313,14 @@ int main(int argc, char *argv[]) {
             continue;
         }
 
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(reuseport &&
+           setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+            close(server_fd);
+            perror("server: SO_REUSEPORT");
+            continue;
+        }
+
         if(bind(server_fd, info->ai_addr, info->ai_addrlen) == -1) {
             close(server_fd);
             perror("server: bind");
@@ -134,510 +333,208 @@ int main(int argc, char *argv[]) {
     if(info == NULL) {
         freeaddrinfo(servinfo);
         fprintf(stderr, "server: failed to bind\n");
-        return 2;
+        return -1;
     }
 
     freeaddrinfo(servinfo); 
 
-    if(listen(server_fd, 3) == -1) {
+    if(listen(server_fd, backlog) == -1) {
         perror("listen");
-        return 1;
-    }
-    struct sockaddr_storage remote_addr;
-    socklen_t remote_addrlen = sizeof(remote_addr);   
-    printf("Server listening on port %d...\n", port);
-
-    // main loop: accept new players and handle waiting player state
-    while(1) {
-        // Setup poll structure
-        pollfds[0].fd = server_fd;
-        pollfds[0].events = POLLIN;
-        nfds = 1;
-
-        // if someone is waiting, watch their socket too
-        if(waiting) {
-            pollfds[1].fd = waiting_player.fd;
-            pollfds[1].events = POLLIN;
-            nfds = 2;
-        }
-
-        activity = poll(pollfds, nfds, -1); 
-        if(activity < 0) {
-            if(errno == EINTR) continue;
-            perror("poll");
-            continue;
-        }
-
-        // handle extra messages from the waiting player
-        if(waiting && (pollfds[1].revents & POLLIN)) {
-            memset(buf, 0, BUF_SIZE);
-            valread = read(waiting_player.fd, buf, BUF_SIZE);
-
-            // if waiting player disconnects
-            if(valread <= 0) {
-                printf("Waiting player %s disconnected before match.\n", waiting_player.name);
-                close(waiting_player.fd);
-                waiting = 0;
-                continue;
-            }
-
-            // waiting player sent some message, check it
-            if(buf[0] != '0') {
-                send_fail(waiting_player.fd, (char *)"10", (char *)"Invalid", 1);
-                waiting = 0;
-                continue;
-            }
-
-            char type[5];
-            memset(type, 0, sizeof(type));
-            strncpy(type, buf + 5, 4);
-            type[4] = '\0';
-
-            // second OPEN on same connection
-            if(strcmp(type, "OPEN") == 0) {
-                send_fail(waiting_player.fd, (char *)"23", (char *)"Already Open", 1);
-            }
-            // MOVE while not in a game yet
-            else if(strcmp(type, "MOVE") == 0) {
-                send_fail(waiting_player.fd, (char *)"24", (char *)"Not Playing", 1);
-            }
-            // any other bad message
-            else {
-                send_fail(waiting_player.fd, (char *)"10", (char *)"Invalid", 1);
-            }
-
-            waiting = 0;
-        }
-
-        // new incoming connection on listening socket
-        if(pollfds[0].revents & POLLIN) {
-            new_socket = accept(server_fd, (struct sockaddr *)&remote_addr, &remote_addrlen);
-
-            if(new_socket < 0) {
-                perror("accept failed");
-                continue;
-            }
-
-            memset(buf, 0, BUF_SIZE);
-            valread = read(new_socket, buf, BUF_SIZE);
-            if(valread <= 0) {
-                close(new_socket);
-                continue;
-            }
-
-            // first byte must be '0', otherwise FAIL 10.
-            if (buf[0] != '0') {
-                send_fail(new_socket, (char *)"10", (char *)"Invalid", 1);
-                continue;
-            }
-
-            // message must contain OPEN as the first command on a new connection
-            if (strstr(buf, "OPEN") == NULL) {
-                send_fail(new_socket, (char *)"10", (char *)"Invalid", 1);
-                continue;
-            }
-
-            // find player name in OPEN message
-            ptr = buf;
-            pipes_count = 0;
-            name_start = NULL;
-
-            while(*ptr) {
-                if(*ptr == '|') {
-                    pipes_count++;
-                    if(pipes_count == 3) {
-                        name_start = ptr + 1;
-                        break;
-                    }
-                }
-                ptr++;
-            }
-
-            if(name_start == NULL) {
-                send_fail(new_socket, (char *)"10", (char *)"Invalid", 1);
-                continue;
-            }
-
-            name_end = strchr(name_start, '|');
-            if(name_end != NULL) {
-                *name_end = '\0';
-            }
-
-            if(strlen(name_start) > MAX_NAME) {
-                send_fail(new_socket, (char *)"21", (char *)"Long Name", 1);
-                continue;
-            }
-
-            // check if this name is already playing somewhere
-            int in_use = 0;
-
-            // check waiting player name
-            if(waiting && strcmp(name_start, waiting_player.name) == 0) {
-                in_use = 1;
-            } else {
-                // check every active game
-                for(i = 0; i < MAX_GAMES; i++) {
-                    if(games[i].active) {
-                        if(strcmp(name_start, games[i].p1) == 0 ||
-                            strcmp(name_start, games[i].p2) == 0) {
-                            in_use = 1;
-                            break;
-                        }
-                    }
-                }
-            }
-
-            if(in_use) {
-                send_fail(new_socket, (char *)"22", (char *)"Already Playing", 1);
-                continue;
-            }
-
-            Player temp;
-            temp.fd = new_socket;
-            strcpy(temp.name, name_start);
-
-            // tell new player to wait
-            write(new_socket, wait_msg, strlen(wait_msg));
-
-            // if no one is waiting, store this player
-            if(!waiting) {
-                waiting_player = temp;
-                waiting = 1;
-                printf("Player %s is waiting.\n", waiting_player.name);
-            } else {
-                // if someone is waiting, start a new game with two players
-                printf("Matching %s with %s.\n",
-                       waiting_player.name, temp.name);
-
-                // find a free game slot
-                int game_index = -1;
-                for(i = 0; i < MAX_GAMES; i++) {
-                    if(!games[i].active) {
-                        game_index = i;
-                        break;
-                    }
-                }
-
-                if(game_index == -1) {
-                    // no room for more games
-                    send_fail(waiting_player.fd, (char *)"20", (char *)"Server Busy", 1);
-                    send_fail(temp.fd, (char *)"20", (char *)"Server Busy", 1);
-                    close(waiting_player.fd);
-                    close(temp.fd);
-                    waiting = 0;
-                } else {
-                    // record the game in the games array
-                    games[game_index].active = 1;
-                    games[game_index].pid = 0;
-                    strncpy(games[game_index].p1, waiting_player.name, MAX_NAME);
-                    games[game_index].p1[MAX_NAME] = '\0';
-                    strncpy(games[game_index].p2, temp.name, MAX_NAME);
-                    games[game_index].p2[MAX_NAME] = '\0';
-
-                    pid = fork();
-                    if(pid == 0) {
-                        // child handles the actual game
-                        close(server_fd);
-                        play_game(waiting_player, temp);
-                        exit(0);
-                    } else if(pid > 0) {
-                        // parent stores the child's pid, closes fds, clears waiting
-                        games[game_index].pid = pid;
-                        close(waiting_player.fd);
-                        close(temp.fd);
-                        waiting = 0;
-                    } else {
-                        perror("fork");
-                        // undo game slot
-                        games[game_index].active = 0;
-                        games[game_index].p1[0] = '\0';
-                        games[game_index].p2[0] = '\0';
-                        close(new_socket);
-                    }
-                }
-            }
-        }
-
+        close(server_fd);
+        return -1;
     }
 
-    return 0;
+    return server_fd;
 }
 
-// handle SIGCHLD to clean up child processes and clear finished games
-void sigchld_handler(int s) {
-    pid_t dead;
-
-    // collect all finished children
-    while((dead = waitpid(-1, NULL, WNOHANG)) > 0) {
-        int i;
-        for(i = 0; i < MAX_GAMES; i++) {
-            if(games[i].active && games[i].pid == dead) {
-                games[i].active = 0;
-                games[i].pid = 0;
-                games[i].p1[0] = '\0';
-                games[i].p2[0] = '\0';
-                break;
-            }
+// main server program
+int main(int argc, char *argv[]) {
+    int port;
+    int i;
+    int opt;
+    int event_mode = 0;
+    int max_games = 0;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *piles = NULL;
+    const char *metrics_port = NULL;
+    int misere = 0;
+    int max_take = 0;
+    sigset_t sigchld;
+    PoolParent pool = { start_game, resume_game, parent_readable, { -1, -1 } };
+
+    while((opt = getopt(argc, argv, "m:g:t:p:Mk:B:O:T:I:R:J:F:L:S:")) != -1) {
+        switch(opt) {
+        case 'm':
+            if(strcmp(optarg, "fork") == 0) event_mode = 0;
+            else if(strcmp(optarg, "event") == 0) event_mode = 1;
+            else usage(argv[0]);
+            break;
+        case 'g':
+            max_games = atoi(optarg);
+            if(max_games < 1) usage(argv[0]);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            if(threads < 1) usage(argv[0]);
+            break;
+        case 'p':
+            piles = optarg;
+            break;
+        case 'M':
+            misere = 1;
+            break;
+        case 'k':
+            max_take = atoi(optarg);
+            if(max_take < 1) usage(argv[0]);
+            break;
+        case 'B':
+            // a player left waiting this many ms plays the built-in bot
+            bot_after_ms = atoi(optarg);
+            if(bot_after_ms < 0) usage(argv[0]);
+            break;
+        case 'O':
+            open_timeout_ms = atoi(optarg);
+            if(open_timeout_ms < 0) usage(argv[0]);
+            break;
+        case 'T':
+            turn_timeout_ms = atoi(optarg);
+            if(turn_timeout_ms < 0) usage(argv[0]);
+            break;
+        case 'I':
+            idle_timeout_ms = atoi(optarg);
+            if(idle_timeout_ms < 0) usage(argv[0]);
+            break;
+        case 'R':
+            // a player who drops out of a game may OPEN again this long
+            resume_grace_ms = atoi(optarg);
+            if(resume_grace_ms < 0) usage(argv[0]);
+            break;
+        case 'J':
+            journal_path = optarg;
+            break;
+        case 'F':
+            journal_fsync_ms = atoi(optarg);
+            if(journal_fsync_ms < 0) usage(argv[0]);
+            break;
+        case 'L':
+            log_level = log_parse_level(optarg);
+            if(log_level < 0) usage(argv[0]);
+            break;
+        case 'S':
+            metrics_port = optarg;
+            break;
+        default:
+            usage(argv[0]);
         }
     }
-}
-
-// handle a single message from one player during a game
-int handle_message(Player *me, Player *opp, int *turn, int my_id) {
-    char buf[BUF_SIZE];
-    int n;
-    char type[5];
-    char *pile_str, *count_str, *split, *end;
-    int pile_idx, count;
-
-    memset(buf, 0, BUF_SIZE);
-
-    // read one message, retry if interrupted
-    do {
-        n = read(me->fd, buf, BUF_SIZE);
-    } while(n < 0 && errno == EINTR);
-
-    // if read <= 0, player disconnected (forfeit)
-    if(n <= 0) {
-        printf("Player %s disconnected (forfeit).\n", me->name);
-        return -1;
-    }
 
-    // check NGP version
-    if(buf[0] != '0') {
-        send_fail(me->fd, (char *)"10", (char *)"Invalid", 1);
-        return -1;
+    if(optind != argc - 1) {
+        usage(argv[0]);
     }
 
-    memset(type, 0, sizeof(type));
-    strncpy(type, buf + 5, 4);
-    type[4] = '\0';
-
-    // second OPEN during game is not allowed
-    if(strcmp(type, "OPEN") == 0) {
-        send_fail(me->fd, (char *)"23", (char *)"Already Open", 1);
-        return -1;
+    // every game on this server plays by the same rules
+    if(board_configure(piles, misere, max_take) == -1) {
+        fprintf(stderr, "-p takes 1 to %d comma separated pile sizes of 0-255, not all 0\n", MAX_PILES);
+        exit(1);
     }
 
-    // only MOVE messages are valid here
-    if(strcmp(type, "MOVE") != 0) {
-        send_fail(me->fd, (char *)"10", (char *)"Invalid", 1);
-        return -1;
+    // solved once here, every worker thread and process only reads it
+    if(solve_init() == -1) {
+        fprintf(stderr, "Too many misere positions to solve, the bot plays without the solver.\n");
     }
 
-    // check if it is this player's turn
-    if(*turn != my_id) {
-        send_fail(me->fd, (char *)"31", (char *)"Impatient", 0);
-        return 2;
+    // every worker thread or process appends to the one journal
+    if(journal_path != NULL && journal_create(journal_path) == -1) {
+        exit(1);
     }
 
-    // parse pile index and count from message
-    pile_str = buf + 10;
-
-    split = strchr(pile_str, '|');
-    if(!split) {
-        send_fail(me->fd, (char *)"10", (char *)"Invalid", 1);
-        return -1;
+    struct sigaction sa_pipe;
+    memset(&sa_pipe, 0, sizeof(sa_pipe));
+    sa_pipe.sa_handler = SIG_IGN;
+    if(sigaction(SIGPIPE, &sa_pipe, NULL) == -1) {
+        perror("sigaction SIGPIPE failed");
+        exit(1);
     }
 
-    *split = '\0';
-    count_str = split + 1;
+    port = atoi(argv[optind]);
 
-    end = strchr(count_str, '|');
-    if(end) *end = '\0';
+    // both modes keep every waiting player's socket open in one process
+    raise_fd_limit();
 
-    pile_idx = atoi(pile_str);
-    count = atoi(count_str);
-
-    // check pile index range
-    if(pile_idx < 0 || pile_idx > 4) {
-        send_fail(me->fd, (char *)"32", (char *)"Pile Index", 0);
-        return 2;
+    // one metrics slot per worker thread, or for the parent and each worker
+    // process, made before any of them start
+    nworkers = threads < MAX_WORKERS ? threads : MAX_WORKERS;
+    if(metrics_port != NULL &&
+       metrics_open(event_mode ? threads : 1 + nworkers, open_listener(metrics_port, 16, 0)) == -1) {
+        exit(1);
     }
 
-    // check count range
-    if(count < 1 || count > piles[pile_idx]) {
-        send_fail(me->fd, (char *)"33", (char *)"Quantity", 0);
-        return 2;
+    if(event_mode) {
+        printf("Server listening on port %d...\n", port);
+        return event_main(argv[optind], max_games ? max_games : EVENT_MAX_GAMES, threads);
     }
 
-    // apply move to the board
-    piles[pile_idx] -= count;
-    printf("Player %s removed %d from pile %d\n",
-           me->name, count, pile_idx);
-
-    return 1;
-}
-
-// run one Nim game between two players
-void play_game(Player p1, Player p2) {
-    char buf[BUF_SIZE];
-    char body[MSG_BODY_SIZE];
-    int current_turn = 1;
-    int game_running = 1;
-    int activity, result, i, stones_left;
-    struct pollfd game_fds[2];
-
-    // set initial piles to 1, 3, 5, 7, 9
-    for(i = 0; i < 5; i++) {
-        piles[i] = 2 * i + 1;
+    // initialize games array, every slot starts on the free list
+    games_len = max_games ? max_games : MAX_GAMES;
+    games = calloc(games_len, sizeof(*games));
+    if(games == NULL) {
+        perror("calloc");
+        exit(1);
     }
-
-    // tell player 1 about player 2
-    snprintf(body, sizeof(body), "NAME|1|%s|", p2.name);
-    int len = (int)strlen(body);
-    if(len > 99) len = 99;
-    snprintf(buf, sizeof(buf), "0|%02d|%s", len, body);
-    write(p1.fd, buf, strlen(buf));
-
-    // tell player 2 about player 1
-    snprintf(body, sizeof(body), "NAME|2|%s|", p1.name);
-    len = (int)strlen(body);
-    if(len > 99) len = 99;
-    snprintf(buf, sizeof(buf), "0|%02d|%s", len, body);
-    write(p2.fd, buf, strlen(buf));
-
-    // send initial board state
-    broadcast_play(p1.fd, p2.fd, current_turn);
-
-    // main game loop
-    while(game_running) {
-        game_fds[0].fd = p1.fd;
-        game_fds[0].events = POLLIN;
-        game_fds[1].fd = p2.fd;
-        game_fds[1].events = POLLIN;
-
-        activity = poll(game_fds, 2, -1);
-        if(activity < 0) {
-            if(errno == EINTR) continue;
-            perror("poll error");
-            break;
-        }
-
-        // handle input from player 1
-        if(game_fds[0].revents & POLLIN) {
-            result = handle_message(&p1, &p2, &current_turn, 1);
-
-            // result < 0 means p1 forfeited or bad error
-            if(result < 0) {
-                send_over(p2.fd, -1, 2, (char *)"Forfeit");
-                game_running = 0;
-                break;
-            }
-
-            // result == 1 means valid move
-            if(result == 1) {
-                stones_left = 0;
-                for(i = 0; i < 5; i++) stones_left += piles[i];
-
-                // if no stones left, player 1 wins normally
-                if(stones_left == 0) {
-                    send_over(p1.fd, p2.fd, 1, (char *)"");
-                    game_running = 0;
-                    break;
-                }
-
-                // switch turn to player 2
-                current_turn = 2;
-                broadcast_play(p1.fd, p2.fd, current_turn);
-            }
-        }
-
-        // handle input from player 2
-        if(game_running && (game_fds[1].revents & POLLIN)) {
-            result = handle_message(&p2, &p1, &current_turn, 2);
-
-            // result < 0 means p2 forfeited or bad error
-            if(result < 0) {
-                send_over(p1.fd, -1, 1, (char *)"Forfeit");
-                game_running = 0;
-                break;
-            }
-
-            // result == 1 means valid move
-            if(result == 1) {
-                stones_left = 0;
-                for(i = 0; i < 5; i++) stones_left += piles[i];
-
-                // if no stones left, player 2 wins normally
-                if(stones_left == 0) {
-                    send_over(p1.fd, p2.fd, 2, (char *)"");
-                    game_running = 0;
-                    break;
-                }
-
-                // switch turn to player 1
-                current_turn = 1;
-                broadcast_play(p1.fd, p2.fd, current_turn);
-            }
-        }
+    for(i = games_len - 1; i >= 0; i--) {
+        games[i].next_free = games_free;
+        games_free = i;
     }
 
-    // close both sockets at end of game
-    shutdown(p1.fd, SHUT_WR);
-    shutdown(p2.fd, SHUT_WR);
-    sleep(1);
-    close(p1.fd);
-    close(p2.fd);
-}
-
-// send PLAY message to both players
-void broadcast_play(int fd1, int fd2, int next_player) {
-    char buf[BUF_SIZE];
-    char body[MSG_BODY_SIZE];
-    char piles_str[50];
-
-    snprintf(piles_str, sizeof(piles_str),
-             "%d %d %d %d %d",
-             piles[0], piles[1], piles[2], piles[3], piles[4]);
-
-    snprintf(body, sizeof(body), "PLAY|%d|%s|", next_player, piles_str);
-    int len = (int)strlen(body);
-    if(len > 99) len = 99;
-    snprintf(buf, sizeof(buf), "0|%02d|%s", len, body);
-
-    write(fd1, buf, strlen(buf));
-    write(fd2, buf, strlen(buf));
-
-    printf("Sent PLAY. Next: %d. Board: %s\n", next_player, piles_str);
-}
-
-// send OVER message to one or two players
-void send_over(int fd1, int fd2, int winner, char *reason) {
-    char buf[BUF_SIZE];
-    char body[MSG_BODY_SIZE];
-    char piles_str[50];
+    // dead workers are reaped from the event loop, SIGCHLD arrives as a
+    // readable fd instead of interrupting whatever main is doing
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &sigchld, NULL) == -1 ||
+       (sig_fd = signalfd(-1, &sigchld, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        perror("signalfd SIGCHLD failed");
+        exit(1);
+    }
 
-    snprintf(piles_str, sizeof(piles_str),
-             "%d %d %d %d %d",
-             piles[0], piles[1], piles[2], piles[3], piles[4]);
+    if(socketpair(AF_UNIX, SOCK_DGRAM, 0, done_fds) == -1) {
+        perror("socketpair");
+        exit(1);
+    }
 
-    snprintf(body, sizeof(body), "OVER|%d|%s|%s|",
-             winner, piles_str, reason);
-    int len = (int)strlen(body);
-    if(len > 99) len = 99;
-    snprintf(buf, sizeof(buf), "0|%02d|%s", len, body);
+    printf("Server listening on port %d...\n", port);
 
-    if(fd1 != -1) write(fd1, buf, strlen(buf));
-    if(fd2 != -1) write(fd2, buf, strlen(buf));
+    // games run in pre-forked workers, so a match costs a sendmsg, not a fork
+    for(i = 0; i < nworkers; i++) {
+        if(spawn_worker(i) == -1) return 1;
+    }
+    printf("Running games on %d worker processes.\n", nworkers);
 
-    printf("Game Over. Winner: %d. Reason: %s\n", winner, reason);
+    // this process only accepts and matches players
+    pool.fds[0] = sig_fd;
+    pool.fds[1] = done_fds[0];
+    return event_parent(argv[optind], &pool);
 }
 
-// send FAIL message and maybe close connection
-void send_fail(int fd, char *code, char *msg, int close_conn) {
-    char buf[BUF_SIZE];
-    char body[MSG_BODY_SIZE];
+// collect workers that died, their games are lost with them, and start new
+// ones in their place
+static void reap_workers(void) {
+    struct signalfd_siginfo info;
+    pid_t dead;
+    int w, g;
 
-    snprintf(body, sizeof(body), "FAIL|%s|%s|", code, msg);
-    int len = (int)strlen(body);
-    if(len > 99) len = 99;
-    snprintf(buf, sizeof(buf), "0|%02d|%s", len, body);
+    // signals coalesce, so the siginfo only says to look, waitpid says who
+    while(read(sig_fd, &info, sizeof(info)) == sizeof(info));
 
-    write(fd, buf, strlen(buf));
+    while((dead = waitpid(-1, NULL, WNOHANG)) > 0) {
+        w = pid_remove(dead);
+        if(w < 0) continue;
 
-    if(close_conn) {
-        shutdown(fd, SHUT_WR);
-        close(fd);
+        fprintf(stderr, "Worker %d (pid %d) exited, restarting it.\n", w, (int)dead);
+        read_done();
+        for(g = 0; g < games_len; g++) {
+            if(games[g].active && games[g].worker == w) finish_game(g);
+        }
+        close(workers[w].fd);
+        spawn_worker(w);
     }
 }
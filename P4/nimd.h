@@ -0,0 +1,440 @@
+#ifndef NIMD_H
+#define NIMD_H
+
+#define MAX_NAME 72
+#define BUF_SIZE 256
+
+// FAIL codes
+#define FAIL_INVALID 10
+#define FAIL_BUSY 20
+#define FAIL_LONG_NAME 21
+#define FAIL_PLAYING 22
+#define FAIL_OPEN 23
+#define FAIL_NOT_PLAYING 24
+#define FAIL_IMPATIENT 31
+#define FAIL_PILE 32
+#define FAIL_QUANTITY 33
+
+#define MAX_PILES 16    // keeps the longest OVER frame within NGP_MAX_FRAME
+
+// rules every game on this server plays by, see board.c
+typedef struct {
+    int npiles;
+    unsigned char start[MAX_PILES];
+    int misere;             // whoever takes the last stone loses
+    int max_take;           // most stones one move may take, 0 for no limit
+} Rules;
+
+extern Rules rules;
+
+// one game's board, a handful of bytes so boards pack densely, see board.c
+typedef struct {
+    unsigned char piles[MAX_PILES];
+    unsigned short stones;  // total left, kept up to date by board_take
+    unsigned short seq;     // moves taken so far, also counted by board_take
+    unsigned char last;     // pile the last move took from
+    unsigned char turn;     // player to move, 1 or 2
+} Board;
+
+int board_configure(const char *sizes, int misere, int max_take);
+void board_init(Board *b);
+int board_stones(const Board *b);
+int board_winner(const Board *b, int mover);
+int board_take(Board *b, int pile_idx, int count);
+char *board_render(const Board *b, char *p);
+
+// write v in decimal at p, returns the end, nothing is terminated; v is a
+// pile count, a pile index or a move number, so never past 65535
+static inline char *put_count(char *p, unsigned int v) {
+    if(v >= 10000) *p++ = '0' + v / 10000;
+    if(v >= 1000) *p++ = '0' + v / 1000 % 10;
+    if(v >= 100) *p++ = '0' + v / 100 % 10;
+    if(v >= 10) *p++ = '0' + v / 10 % 10;
+    *p++ = '0' + v % 10;
+    return p;
+}
+
+// built-in opponent, see bot.c
+typedef struct {
+    int pile;
+    int count;
+} BotMove;
+
+extern int bot_after_ms;    // a player waiting this long plays the bot, -1 never
+extern const char bot_name[];
+
+void bot_plan(const Board *const *boards, int n, BotMove *moves);
+
+// Sprague-Grundy solver for the configured rules, see solve.c
+int solve_init(void);
+int solve_wins(const Board *b);
+int solve_move(const Board *b, BotMove *m);
+long solve_table_bytes(void);
+
+// timer wheel, one per event loop shard, see timer.c
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOTS 64
+
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer **pprev;   // NULL while not armed
+    long long expires;      // tick, ms
+    int where;              // level * WHEEL_SLOTS + slot, -1 once due
+} Timer;
+
+typedef struct {
+    long long now;
+    Timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    unsigned long long used[WHEEL_LEVELS];  // bit per slot with timers in it
+    Timer *due;             // fired, not handed out yet
+    int armed;              // timers in the slots
+} Wheel;
+
+void wheel_init(Wheel *w, long long now);
+void timer_arm(Wheel *w, Timer *t, long long expires);
+void timer_cancel(Wheel *w, Timer *t);
+void wheel_advance(Wheel *w, long long now);
+Timer *wheel_expired(Wheel *w);
+int wheel_timeout(Wheel *w);
+
+// append-only game journal, see journal.c. The file starts with the 8 bytes
+// of JOURNAL_MAGIC, then records: a little-endian u16 length of the whole
+// record, a type byte, and by type
+//   START  u64 game, u64 wall clock ms, u8 player the bot plays (0 for none),
+//          u8 misere, u8 max_take, u8 npiles, the starting piles, then each
+//          player's name as u8 length and bytes
+//   MOVE   u64 game, u32 ms since start, u8 player, u8 pile, u8 count
+//   OVER   u64 game, u32 ms since start, u8 winner, u8 forfeit
+//   LOST   u64 game, whose records stop here because one was dropped
+#define JOURNAL_MAGIC { 'N', 'I', 'M', 'J', 1, 0, 0, 0 }
+#define JOURNAL_HDR_LEN 8
+#define JOURNAL_MOVE_LEN 18
+#define JOURNAL_OVER_LEN 17
+#define JOURNAL_LOST_LEN 11
+#define JOURNAL_MAX_RECORD (3 + 8 + 8 + 4 + MAX_PILES + 2 * (1 + MAX_NAME))
+
+enum {
+    JOURNAL_START = 1,
+    JOURNAL_MOVE,
+    JOURNAL_OVER,
+    JOURNAL_LOST
+};
+
+typedef struct {
+    unsigned long long records;     // put in a ring
+    unsigned long long dropped;     // lost to a full ring
+    unsigned long long bytes;       // written to the file
+    unsigned long long batches;     // writes
+    unsigned long long syncs;
+} JournalStats;
+
+extern const char *journal_path;    // NULL records nothing
+extern int journal_fsync_ms;        // 0 syncs every write
+
+int journal_create(const char *path);
+int journal_open(int n);
+unsigned long long journal_start(int r, const char *p1, const char *p2, int bot);
+void journal_move(int r, unsigned long long *game, unsigned int ms, int player, int pile,
+                  int count);
+void journal_over(int r, unsigned long long *game, unsigned int ms, int winner, int forfeit);
+void journal_stats(JournalStats *st);
+
+// structured log levels, -L picks the lowest one written, see log.c
+enum { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_OFF };
+
+enum {
+    LOG_WAITING,
+    LOG_MATCHED,
+    LOG_MOVED,
+    LOG_PLAY,
+    LOG_OVER,
+    LOG_LEFT,
+    LOG_HELD,
+    LOG_RESUMED,
+    LOG_TIMED_OUT,
+    LOG_NOT_READING,
+    LOG_NEVENTS
+};
+
+// what an event carries, fields left out are not written
+typedef struct {
+    long long ms;           // latency of what the event ends, -1 for none
+    unsigned long long game;
+    int player;
+    int a, b;               // pile and count of a move, the winner of a game
+    const char *what;       // a static "key=value" or two
+    const char *name;
+    const char *opp;
+    const Board *board;
+} LogFields;
+
+extern int log_level;
+extern const unsigned char log_event_level[];
+
+// a skipped event costs one compare, its fields are never evaluated
+#define LOG(event, ...) do { \
+    if(log_event_level[event] >= log_level) { \
+        log_put((event), &(LogFields){ .ms = -1, __VA_ARGS__ }); \
+    } \
+} while(0)
+
+void log_put(int event, const LogFields *f);
+void log_init(void);
+int log_parse_level(const char *name);
+
+// latency histograms kept for -S, see metrics.c
+enum {
+    METRIC_OPEN_WAIT,   // OPEN read to WAIT written
+    METRIC_OPEN_NAME,   // the later OPEN of a pair read to NAME written
+    METRIC_MOVE_PLAY,   // MOVE read to the PLAY it causes written
+    METRIC_GAME,        // first PLAY to OVER
+    METRIC_NSTAGES
+};
+
+int metrics_open(int n, int fd);
+void metrics_attach(int slot);
+long long metrics_now(void);
+void metrics_accept(void);
+void metrics_fail(int code);
+void metrics_time(int stage, long long us);
+void metrics_reply(int stage, long long since);
+void metrics_round(int games, int waiting);
+void metrics_journal_drop(void);
+
+// log-linear latency histogram buckets, shared by metrics.c and nimbench so
+// the server's and the clients' percentiles can be set side by side: values
+// below HIST_SUB have a bucket each, and each power of two above that is
+// split into HIST_SUB buckets
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (40 * HIST_SUB)    // up to 2^41us, about 25 days
+
+static inline int hist_bucket(unsigned long long v) {
+    int e, b;
+
+    if(v < HIST_SUB) return v;
+    e = 63 - __builtin_clzll(v);
+    b = (e - HIST_SUB_BITS + 1) * HIST_SUB + (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+    return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+// the largest value bucket b holds
+static inline unsigned long long hist_top(int b) {
+    int e;
+
+    if(b < HIST_SUB) return b;
+    e = b / HIST_SUB + HIST_SUB_BITS - 1;
+    return ((unsigned long long)(HIST_SUB + b % HIST_SUB + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+// bucket the q quantile falls in, of counts that add up to total
+static inline int hist_quantile(const unsigned long long *counts, unsigned long long total,
+                                double q) {
+    unsigned long long seen = 0, want = (unsigned long long)(q * total + 0.999999);
+    int b;
+
+    for(b = 0; b < HIST_BUCKETS - 1; b++) {
+        seen += counts[b];
+        if(seen >= want) break;
+    }
+    return b;
+}
+
+#define NGP_HDR_LEN 5                      // "0|NN|"
+#define NGP_MAX_FRAME (NGP_HDR_LEN + 99)
+#define FRAMER_SIZE 256                    // power of two, holds a partial frame and more
+
+// binary NGP v1, chosen by a client whose first frame starts with '1': then
+// a length byte, and that many bytes, the first of them the type
+#define NGP1_HDR_LEN 2
+#define NGP1_OPEN 'O'   // name length, name, optionally the 16 hex digit token,
+                        // optionally flags, NGP_OPEN_DELTA
+#define NGP1_MOVE 'M'   // pile, count
+#define NGP1_SYNC 'Y'   // asks for SNAP
+#define NGP1_WAIT 'W'
+#define NGP1_NAME 'N'   // player number, opponent's name
+#define NGP1_SESS 'S'   // 16 hex digit token
+#define NGP1_PLAY 'P'   // player to move, a byte per pile
+#define NGP1_SNAP 'B'   // player to move, seq (2 bytes, big endian), a byte per pile
+#define NGP1_DLTA 'D'   // player to move, seq (2 bytes, big endian), pile, count left
+#define NGP1_OVER 'R'   // winner, 1 if by forfeit, a byte per pile
+#define NGP1_FAIL 'F'   // FAIL code
+
+#define NGP_OPEN_DELTA 1    // after a move send DLTA, not PLAY; SNAP for the whole board
+
+// bytes received on a connection that have not formed a frame yet, see ngp.c
+typedef struct {
+    char ring[FRAMER_SIZE];
+    unsigned int head;  // bytes consumed so far
+    unsigned int tail;  // bytes received so far
+    int version;        // 0 or 1, set by the first byte of the stream
+} Framer;
+
+int framer_read(Framer *f, int fd, int flags);
+int framer_next(Framer *f, const char **frame, char *scratch);
+int framer_push(Framer *f, const char *bytes, int len);
+
+// message types a client may send
+enum {
+    NGP_NONE,
+    NGP_OPEN,
+    NGP_MOVE,
+    NGP_SYNC
+};
+
+// a parsed client message, name and token point into the frame they came from
+typedef struct {
+    int type;
+    const char *name;   // OPEN
+    int name_len;
+    const char *token;  // OPEN back into a game, NULL for a new player
+    int token_len;
+    int delta;          // OPEN asked for DLTA updates
+    int pile;           // MOVE
+    int count;
+} NgpMsg;
+
+int ngp_parse(const char *frame, int len, NgpMsg *m);
+unsigned long long ngp_token(const char *s, int len);
+
+// encode a whole frame in NGP version v into dst (at least NGP_MAX_FRAME
+// bytes), returns its length; WAIT and FAIL frames are constant and served
+// from static bytes
+int ngp_encode_name(char *dst, int v, int id, const char *name);
+int ngp_encode_sess(char *dst, int v, unsigned long long token);
+int ngp_encode_play(char *dst, int v, const Board *b);
+int ngp_encode_snap(char *dst, int v, const Board *b);
+int ngp_encode_delta(char *dst, int v, const Board *b);
+int ngp_encode_over(char *dst, int v, const Board *b, int winner, const char *reason);
+const char *ngp_wait_frame(int v, int *len);
+const char *ngp_fail_frame(int v, int code, int *len);
+
+// what a client sends, for the tests and nimbench
+int ngp_encode_open(char *dst, int v, const char *name, int flags);
+int ngp_encode_move(char *dst, int v, int pile, int count);
+int ngp_encode_sync(char *dst, int v);
+
+#define OUTQ_HIGH_WATER (64 * 1024)  // queued output past which a client is dropped
+
+// bytes queued for a connection that the socket has not taken yet, see outq.c
+typedef struct {
+    char *ring;         // allocated on first use, cap is a power of two
+    unsigned int cap;
+    unsigned int head;  // bytes written so far
+    unsigned int tail;  // bytes queued so far
+    int pending;        // 1 + index on this thread's pending list, 0 if off it
+    int over;           // went past OUTQ_HIGH_WATER, drop the connection
+} Outq;
+
+typedef struct {
+    int fd;
+    char name[MAX_NAME + 1];
+    Framer in;
+    Outq out;
+    long long opened;   // with -S, when its OPEN was read, us
+    int delta;          // asked in OPEN for DLTA after each move
+} Player;
+
+int out_push(Player *p, const char *bytes, int len);
+int out_flush(Player *p);
+void out_pend(Player *p);
+void out_unpend(Player *p);
+Player *out_next_pending(void);
+void out_release(Outq *q);
+
+// parse the first message on a new connection, returns 0 and fills in *m on
+// success, otherwise returns the FAIL code
+int parse_open(const char *frame, int len, NgpMsg *m);
+
+// FAIL code for a message sent by a player still waiting for a match
+int waiting_fail(const char *frame, int len);
+
+int apply_message(Board *b, Player *me, int my_id, const char *frame, int len, NgpMsg *m);
+
+// sends only queue the frame, the caller flushes, see outq.c
+void send_name(Player *p, int id, char *opp_name);
+void send_sess(Player *p, unsigned long long token);
+void send_wait(Player *p);
+void send_fail(Player *p, int code);
+void send_over(const Board *b, Player *p1, Player *p2, int winner, char *reason);
+void broadcast_play(const Board *b, Player *p1, Player *p2);
+void broadcast_board(const Board *b, Player *p1, Player *p2);
+
+// one connection's bytes through the exchange in process, see proto.c
+#define NGP_SESSION_WAIT 1      // a frame comes in while waiting for a match
+#define NGP_SESSION_SECOND 2    // the player is player 2, the bot moves first
+
+int ngp_session(Player *me, const char *bytes, int len, int chunk, int flags);
+
+int open_listener(const char *service, int backlog, int reuseport);
+
+// names of waiting and playing players, see names.c
+int name_claim(const char *name);
+void name_release(const char *name);
+
+// where a player's game is, kept with their name so a player who drops out
+// can OPEN again with the token and get their seat back
+typedef struct {
+    unsigned long long token;
+    int home;   // event loop shard, or fork mode worker
+    int game;   // slot there, or the fork mode parent's slot
+    int id;     // 1 or 2 within the game
+} Session;
+
+unsigned long long name_session(const char *name, int home, int game, int id);
+int name_resume(const char *name, unsigned long long token, Session *sess);
+
+// single process epoll server with one worker per thread, see event.c
+int event_main(const char *service, int max_games, int threads);
+
+// deadlines in ms, 0 for none: OPEN after connecting, a move once it is the
+// player's turn, any byte while waiting for a match or after the game
+extern int open_timeout_ms;
+extern int turn_timeout_ms;
+extern int idle_timeout_ms;
+
+// how long a player who dropped out of a game keeps their seat, 0 forfeits
+// at once and gives out no tokens
+extern int resume_grace_ms;
+
+// a matched pair the fork mode parent hands a pool worker, both sockets ride
+// along as SCM_RIGHTS and the worker reports game once the game is over; with
+// resume set it is one player's new socket for a game the worker has
+typedef struct {
+    int game;
+    int bot;            // the second player is the built-in bot, one socket
+    int resume;         // player number coming back to game, one socket
+    char name[2][MAX_NAME + 1];
+    Framer in[2];       // whatever each player sent after their OPEN
+    unsigned long long token[2];    // with -R, what the worker tells them
+    long long opened[2];            // with -S, when their OPENs were read
+    int delta[2];                   // asked for DLTA updates
+} PoolJob;
+
+// fork mode game process, plays every game the parent sends it, see event.c
+int pool_worker(int index, int job_fd, int done_fd, int max_games);
+
+// what the fork mode parent plugs into the event loop that matches players
+typedef struct {
+    int (*start_game)(Player *a, Player *b);  // takes the sockets, b NULL for the
+                                              // bot, 0 if it can not
+    int (*resume)(Player *p, const Session *sess);  // takes the socket back
+                                              // to its game, 0 if it can not
+    void (*readable)(int fd);                 // one of fds woke the loop
+    int fds[2];
+} PoolParent;
+
+int event_parent(const char *service, PoolParent *pp);
+
+// the client side, for tests and nimbench, see client.c
+struct addrinfo;
+struct addrinfo *client_resolve(const char *hostname, const char *port);
+int client_connect(const struct addrinfo *servinfo, int flags);
+int connect_to_server(const char *hostname, const char *port);
+void send_raw(int fd, const char *msg);
+void send_ngp(int fd, const char *body);
+void send_frame(int fd, const char *frame, int len);
+int read_frame(int fd, Framer *in, char frame[NGP_MAX_FRAME + 1], long long deadline);
+long long deadline_in(int ms);
+
+#endif
@@ -0,0 +1,485 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nimd.h"
+
+// Offline replay of game journals written with nimd -J, see journal.c. Each
+// journal is mapped and walked record by record, and every move goes through
+// board_take, the check nimd itself applies, along with whose turn it is, so
+// a journal that does not add up shows as invalid moves. The solver judges
+// each move too: one that leaves the opponent a won position when the mover
+// had a won one is a mistake. A game nimd stopped recording because its
+// ring was full, named by a LOST record, counts as lost rather than invalid
+// or unfinished. Run as
+// ./nimreplay [-j threads] journal ...
+//
+// Memory does not grow with the journal: the only state kept is the board of
+// each game started and not yet over, and the pages already read are dropped
+// from the mapping as the walk goes. Files are spread over the threads, a
+// game's records may sit anywhere after its START in its file, so one file
+// is never split.
+
+#define DROP_CHUNK (16L << 20)  // pages read are let go this many bytes at a time
+
+enum {
+    SEAT_P1,
+    SEAT_P2,
+    SEAT_BOT,
+    NSEATS
+};
+
+typedef struct {
+    unsigned long long games;       // started
+    unsigned long long finished;
+    unsigned long long forfeits;
+    unsigned long long p1_wins;
+    unsigned long long moves;       // in finished games
+    unsigned long long game_ms;     // length of finished games
+    unsigned long long invalid;     // moves or results the rules do not allow
+    unsigned long long orphans;     // records of a game with no START
+    unsigned long long other_rules; // games under rules other than the first
+    unsigned long long unfinished;  // no OVER by the end of the file
+    unsigned long long lost;        // records dropped by nimd, see journal.c
+    unsigned long long truncated;   // files that end inside a record
+    unsigned long long first_ms;    // wall clock of the first and last START
+    unsigned long long last_ms;
+    unsigned long long won[NSEATS];     // moves made from a won position
+    unsigned long long thrown[NSEATS];  // of those, moves that gave it away
+} Stats;
+
+// a game in progress, in an open addressing table keyed on the game
+typedef struct {
+    unsigned long long game;    // 0 marks an empty slot
+    Board board;
+    int bot;
+    unsigned int moves;
+    int skip;                   // other rules, records are only counted
+} Live;
+
+typedef struct {
+    Live *slots;
+    unsigned long mask;
+    unsigned long len;
+} LiveTable;
+
+static unsigned char rules_key[4 + MAX_PILES];  // misere, max_take, npiles, piles
+static int rules_len;
+
+static char **files;
+static int nfiles;
+static atomic_int next_file;
+
+static unsigned int get_u16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+static unsigned int get_u32(const unsigned char *p) {
+    return get_u16(p) | get_u16(p + 2) << 16;
+}
+
+static unsigned long long get_u64(const unsigned char *p) {
+    return get_u32(p) | (unsigned long long)get_u32(p + 4) << 32;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long live_home(const LiveTable *t, unsigned long long game) {
+    return (game * 0x9e3779b97f4a7c15ULL >> 20) & t->mask;
+}
+
+// slot of game, or the empty slot where it would go
+static unsigned long live_find(const LiveTable *t, unsigned long long game) {
+    unsigned long i = live_home(t, game);
+
+    while(t->slots[i].game != 0 && t->slots[i].game != game) i = (i + 1) & t->mask;
+    return i;
+}
+
+static Live *live_add(LiveTable *t, unsigned long long game) {
+    unsigned long cap = t->mask + 1;
+    unsigned long i;
+
+    if((t->len + 1) * 2 > cap) {
+        Live *old = t->slots;
+
+        t->slots = calloc(cap * 2, sizeof(*t->slots));
+        if(t->slots == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        t->mask = cap * 2 - 1;
+        for(i = 0; i < cap; i++) {
+            if(old[i].game != 0) t->slots[live_find(t, old[i].game)] = old[i];
+        }
+        free(old);
+    }
+
+    i = live_find(t, game);
+    if(t->slots[i].game == 0) t->len++;
+    memset(&t->slots[i], 0, sizeof(t->slots[i]));
+    t->slots[i].game = game;
+    return &t->slots[i];
+}
+
+static Live *live_get(LiveTable *t, unsigned long long game) {
+    unsigned long i = live_find(t, game);
+
+    return t->slots[i].game != 0 ? &t->slots[i] : NULL;
+}
+
+// remove a game once it is over, shifting its probe run back over the hole
+static void live_remove(LiveTable *t, Live *l) {
+    unsigned long i = l - t->slots;
+    unsigned long j = i, home;
+
+    for(;;) {
+        j = (j + 1) & t->mask;
+        if(t->slots[j].game == 0) break;
+        home = live_home(t, t->slots[j].game);
+        if(i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+        t->slots[i] = t->slots[j];
+        i = j;
+    }
+    t->slots[i].game = 0;
+    t->len--;
+}
+
+// the rules part of a START record: misere, max_take, npiles and the piles
+static int start_rules(const unsigned char *r, int len, const unsigned char **key) {
+    int n;
+
+    if(len < 23) return -1;
+    n = r[22];
+    if(n < 1 || n > MAX_PILES || len < 23 + n + 2) return -1;
+    *key = r + 20;
+    return 3 + n;
+}
+
+// set the rules every replayed game is held to from the first START record
+// found in any of the files, returns -1 if there is none
+static int find_rules(void) {
+    const unsigned char *key;
+    unsigned char buf[JOURNAL_MAX_RECORD];
+    char sizes[MAX_PILES * 4 + 1], *p;
+    int i, fd, len, n;
+
+    for(i = 0; i < nfiles; i++) {
+        fd = open(files[i], O_RDONLY);
+        if(fd == -1) continue;
+
+        // the first record of a journal is normally a START
+        n = pread(fd, buf, sizeof(buf), JOURNAL_HDR_LEN);
+        close(fd);
+        if(n < 3 || buf[2] != JOURNAL_START) continue;
+        len = get_u16(buf);
+        if(len > n || (rules_len = start_rules(buf, len, &key)) < 0) continue;
+        memcpy(rules_key, key, rules_len);
+
+        p = sizes;
+        for(n = 0; n < key[2]; n++) p += sprintf(p, n ? ",%d" : "%d", key[3 + n]);
+        if(board_configure(sizes, key[0], key[1]) == -1) return -1;
+        if(solve_init() == -1) {
+            fprintf(stderr, "nimreplay: too many misere positions, mistakes are not counted\n");
+        }
+        return 0;
+    }
+    return -1;
+}
+
+// whose move it was, as a stats seat
+static int seat(const Live *l, int player) {
+    if(player == l->bot) return SEAT_BOT;
+    return player == 1 ? SEAT_P1 : SEAT_P2;
+}
+
+static void replay_start(Stats *st, LiveTable *t, const unsigned char *r, int len) {
+    const unsigned char *key;
+    unsigned long long wall;
+    Live *l;
+    int n = start_rules(r, len, &key);
+
+    if(n < 0) {
+        st->invalid++;
+        return;
+    }
+
+    l = live_add(t, get_u64(r + 3));
+    l->bot = r[19];
+    l->skip = n != rules_len || memcmp(key, rules_key, n) != 0;
+    board_init(&l->board);
+
+    st->games++;
+    if(l->skip) st->other_rules++;
+
+    wall = get_u64(r + 11);
+    if(st->first_ms == 0 || wall < st->first_ms) st->first_ms = wall;
+    if(wall > st->last_ms) st->last_ms = wall;
+}
+
+static void replay_move(Stats *st, LiveTable *t, const unsigned char *r) {
+    Live *l = live_get(t, get_u64(r + 3));
+    int player = r[15], pile = r[16], count = r[17];
+    int before, after;
+
+    if(l == NULL) {
+        st->orphans++;
+        return;
+    }
+    if(l->skip) return;
+
+    // what apply_message checks, in the same order
+    before = solve_wins(&l->board);
+    if(l->board.turn != player || board_take(&l->board, pile, count) != 0) {
+        st->invalid++;
+        return;
+    }
+    l->moves++;
+    l->board.turn = 3 - player;
+
+    // a mover who could force a win and leaves the opponent able to, an
+    // empty board counts too as the solver knows who won it
+    if(before == 1) {
+        after = solve_wins(&l->board);
+        st->won[seat(l, player)]++;
+        if(after == 1) st->thrown[seat(l, player)]++;
+    }
+}
+
+static void replay_over(Stats *st, LiveTable *t, const unsigned char *r) {
+    Live *l = live_get(t, get_u64(r + 3));
+    int winner = r[15], forfeit = r[16];
+
+    if(l == NULL) {
+        st->orphans++;
+        return;
+    }
+    if(!l->skip) {
+        // a game that ran to the end must be won by who the rules say
+        if(winner < 1 || winner > 2 ||
+           (!forfeit && board_winner(&l->board, 3 - l->board.turn) != winner)) {
+            st->invalid++;
+        }
+        st->finished++;
+        st->forfeits += forfeit;
+        st->p1_wins += winner == 1;
+        st->moves += l->moves;
+        st->game_ms += get_u32(r + 11);
+    }
+    live_remove(t, l);
+}
+
+// the game's records stop here, what it has so far is not judged further
+static void replay_lost(Stats *st, LiveTable *t, const unsigned char *r) {
+    Live *l = live_get(t, get_u64(r + 3));
+
+    if(l == NULL) {
+        st->orphans++;
+        return;
+    }
+    st->lost++;
+    live_remove(t, l);
+}
+
+static void replay_file(Stats *st, const char *path) {
+    struct stat sb;
+    const unsigned char *map, *p, *end;
+    LiveTable t;
+    long dropped = 0;
+    int fd, len;
+
+    fd = open(path, O_RDONLY);
+    if(fd == -1 || fstat(fd, &sb) == -1) {
+        perror(path);
+        if(fd != -1) close(fd);
+        return;
+    }
+    if(sb.st_size < JOURNAL_HDR_LEN) {
+        fprintf(stderr, "%s: not a journal\n", path);
+        close(fd);
+        return;
+    }
+
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        perror(path);
+        return;
+    }
+    if(memcmp(map, (const unsigned char[])JOURNAL_MAGIC, JOURNAL_HDR_LEN) != 0) {
+        fprintf(stderr, "%s: not a journal\n", path);
+        munmap((void *)map, sb.st_size);
+        return;
+    }
+    madvise((void *)map, sb.st_size, MADV_SEQUENTIAL);
+
+    t.mask = 1023;
+    t.len = 0;
+    t.slots = calloc(t.mask + 1, sizeof(*t.slots));
+    if(t.slots == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    p = map + JOURNAL_HDR_LEN;
+    end = map + sb.st_size;
+    while(end - p >= 3) {
+        len = get_u16(p);
+        if(len < 3 || len > end - p) break;
+
+        switch(p[2]) {
+        case JOURNAL_START:
+            replay_start(st, &t, p, len);
+            break;
+        case JOURNAL_MOVE:
+            if(len == JOURNAL_MOVE_LEN) replay_move(st, &t, p);
+            else st->invalid++;
+            break;
+        case JOURNAL_OVER:
+            if(len == JOURNAL_OVER_LEN) replay_over(st, &t, p);
+            else st->invalid++;
+            break;
+        case JOURNAL_LOST:
+            if(len == JOURNAL_LOST_LEN) replay_lost(st, &t, p);
+            else st->invalid++;
+            break;
+        default:
+            st->invalid++;
+        }
+        p += len;
+
+        // keep only the pages still to be read
+        if(p - map - dropped >= DROP_CHUNK) {
+            madvise((void *)(map + dropped), DROP_CHUNK, MADV_DONTNEED);
+            dropped += DROP_CHUNK;
+        }
+    }
+    if(p != end) st->truncated++;
+
+    st->unfinished += t.len;
+    free(t.slots);
+    munmap((void *)map, sb.st_size);
+}
+
+static void stats_add(Stats *to, const Stats *from) {
+    int i;
+
+    to->games += from->games;
+    to->finished += from->finished;
+    to->forfeits += from->forfeits;
+    to->p1_wins += from->p1_wins;
+    to->moves += from->moves;
+    to->game_ms += from->game_ms;
+    to->invalid += from->invalid;
+    to->orphans += from->orphans;
+    to->other_rules += from->other_rules;
+    to->unfinished += from->unfinished;
+    to->lost += from->lost;
+    to->truncated += from->truncated;
+    if(from->first_ms != 0 && (to->first_ms == 0 || from->first_ms < to->first_ms)) {
+        to->first_ms = from->first_ms;
+    }
+    if(from->last_ms > to->last_ms) to->last_ms = from->last_ms;
+    for(i = 0; i < NSEATS; i++) {
+        to->won[i] += from->won[i];
+        to->thrown[i] += from->thrown[i];
+    }
+}
+
+static void *replay_thread(void *arg) {
+    Stats *st = arg;
+    int i;
+
+    while((i = atomic_fetch_add(&next_file, 1)) < nfiles) replay_file(st, files[i]);
+    return NULL;
+}
+
+static double pct(unsigned long long part, unsigned long long whole) {
+    return whole ? 100.0 * part / whole : 0;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *seat_names[NSEATS] = { "player 1", "player 2", "bot" };
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t *tids;
+    Stats *per, total;
+    double start, took, span;
+    int opt, i;
+
+    while((opt = getopt(argc, argv, "j:")) != -1) {
+        switch(opt) {
+        case 'j':
+            threads = atoi(optarg);
+            if(threads < 1) threads = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j threads] journal ...\n", argv[0]);
+            return 1;
+        }
+    }
+    files = argv + optind;
+    nfiles = argc - optind;
+    if(nfiles == 0) {
+        fprintf(stderr, "Usage: %s [-j threads] journal ...\n", argv[0]);
+        return 1;
+    }
+    if(threads > nfiles) threads = nfiles;
+
+    if(find_rules() == -1) {
+        fprintf(stderr, "nimreplay: no game found to take the rules from\n");
+        return 1;
+    }
+
+    per = calloc(threads, sizeof(*per));
+    tids = calloc(threads, sizeof(*tids));
+    if(per == NULL || tids == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    start = now();
+    for(i = 0; i < threads; i++) {
+        if(pthread_create(&tids[i], NULL, replay_thread, &per[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    memset(&total, 0, sizeof(total));
+    for(i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        stats_add(&total, &per[i]);
+    }
+    took = now() - start;
+
+    span = (total.last_ms - total.first_ms) / 1000.0;
+    printf("%d files, %llu games (%llu finished, %llu forfeited, %llu unfinished, %llu lost)\n",
+           nfiles, total.games, total.finished, total.forfeits, total.unfinished, total.lost);
+    printf("games per second:    %.1f while recorded, %.0f replayed\n",
+           span > 0 ? total.games / span : 0.0, took > 0 ? total.games / took : 0.0);
+    printf("average game:        %.1f moves, %.0f ms\n",
+           total.finished ? (double)total.moves / total.finished : 0.0,
+           total.finished ? (double)total.game_ms / total.finished : 0.0);
+    printf("first player wins:   %.1f%%\n", pct(total.p1_wins, total.finished));
+    for(i = 0; i < NSEATS; i++) {
+        if(total.won[i] == 0) continue;
+        printf("%-9s threw a win %llu times in %llu moves from a won position (%.1f%%)\n",
+               seat_names[i], total.thrown[i], total.won[i], pct(total.thrown[i], total.won[i]));
+    }
+    if(total.invalid || total.orphans || total.other_rules || total.truncated) {
+        printf("invalid: %llu, orphan records: %llu, other rules: %llu, truncated files: %llu\n",
+               total.invalid, total.orphans, total.other_rules, total.truncated);
+    }
+    return total.invalid ? 2 : 0;
+}
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "nimd.h"
+
+// Output queues. Every message for a player is appended to that player's
+// queue and the player goes on this thread's pending list; the owner flushes
+// the whole list once per loop iteration with one writev per player, so
+// everything a move produces for a player leaves in a single syscall.
+
+#define OUTQ_MIN 256
+
+static __thread Player **pending;
+static __thread int npending;
+static __thread int pending_cap;
+
+// put a player on this thread's pending list
+void out_pend(Player *p) {
+    if(p->out.pending) return;
+
+    if(npending == pending_cap) {
+        int cap = pending_cap ? pending_cap * 2 : 256;
+        Player **grown = realloc(pending, cap * sizeof(*pending));
+
+        if(grown == NULL) return;   // stays queued, flushed on next push
+        pending = grown;
+        pending_cap = cap;
+    }
+
+    p->out.pending = npending + 1;
+    pending[npending++] = p;
+}
+
+// take a player off the pending list, before it is freed or moves thread
+void out_unpend(Player *p) {
+    int i = p->out.pending - 1;
+
+    if(i < 0) return;
+    npending--;
+    if(i != npending) {
+        pending[i] = pending[npending];
+        pending[i]->out.pending = i + 1;
+    }
+    p->out.pending = 0;
+}
+
+// queue bytes for a player, returns -1 if that would pass the high water
+// mark, in which case the player is marked over and nothing is queued
+int out_push(Player *p, const char *bytes, int len) {
+    Outq *q = &p->out;
+    unsigned int used = q->tail - q->head;
+    unsigned int at, first;
+
+    if(q->over) return -1;
+
+    if(used + len > q->cap) {
+        unsigned int cap = q->cap ? q->cap : OUTQ_MIN;
+        char *grown;
+        unsigned int i;
+
+        while(cap < used + len) cap *= 2;
+        if(cap > OUTQ_HIGH_WATER) {
+            q->over = 1;
+            out_pend(p);
+            return -1;
+        }
+
+        // unwrap into the bigger ring
+        grown = malloc(cap);
+        if(grown == NULL) {
+            q->over = 1;
+            out_pend(p);
+            return -1;
+        }
+        for(i = 0; i < used; i++) {
+            grown[i] = q->ring[(q->head + i) & (q->cap - 1)];
+        }
+        free(q->ring);
+        q->ring = grown;
+        q->cap = cap;
+        q->head = 0;
+        q->tail = used;
+    }
+
+    at = q->tail & (q->cap - 1);
+    first = q->cap - at;
+    if(first > (unsigned int)len) first = len;
+    memcpy(q->ring + at, bytes, first);
+    memcpy(q->ring, bytes + first, len - first);
+    q->tail += len;
+
+    out_pend(p);
+    return 0;
+}
+
+// write as much of the queue as the socket takes
+// returns the bytes still queued, or -1 if the connection is broken
+int out_flush(Player *p) {
+    Outq *q = &p->out;
+    struct iovec iov[2];
+    unsigned int used, at, first;
+    ssize_t n;
+
+    while((used = q->tail - q->head) > 0) {
+        at = q->head & (q->cap - 1);
+        first = q->cap - at;
+        if(first > used) first = used;
+
+        iov[0].iov_base = q->ring + at;
+        iov[0].iov_len = first;
+        iov[1].iov_base = q->ring;
+        iov[1].iov_len = used - first;
+
+        n = writev(p->fd, iov, used > first ? 2 : 1);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        q->head += n;
+    }
+
+    return q->tail - q->head;
+}
+
+// take the next player off this thread's pending list, NULL once it is empty
+// flushing one player may queue output for another, which joins the same pass
+Player *out_next_pending(void) {
+    Player *p;
+
+    if(npending == 0) return NULL;
+    p = pending[--npending];
+    p->out.pending = 0;
+    return p;
+}
+
+void out_release(Outq *q) {
+    free(q->ring);
+    memset(q, 0, sizeof(*q));
+}
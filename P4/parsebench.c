@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "nimd.h"
+
+// Microbenchmark for NGP message parsing: ngp_parse against the strstr /
+// strchr / atoi scanning nimd used before it. Run as ./parsebench [rounds].
+
+static const char *corpus[] = {
+    "0|11|OPEN|Alice|",
+    "0|09|OPEN|Bob|",
+    "0|09|MOVE|0|1|",
+    "0|09|MOVE|4|9|",
+    "0|09|MOVE|2|3|",
+    "0|10|MOVE|3|12|",
+    "0|09|MOVE|9|1|",
+    "0|39|OPEN|SomebodyWithAMuchLongerPlayerName|",
+};
+
+#define NCORPUS ((int)(sizeof(corpus) / sizeof(corpus[0])))
+
+static volatile int sink;
+
+// the old accept path: find OPEN anywhere, then the name after the third pipe
+static int legacy_open(char *buf) {
+    char *ptr, *name_start, *name_end;
+    int pipes_count;
+
+    if(buf[0] != '0') return -10;
+    if(strstr(buf, "OPEN") == NULL) return -10;
+
+    ptr = buf;
+    pipes_count = 0;
+    name_start = NULL;
+    while(*ptr) {
+        if(*ptr == '|') {
+            pipes_count++;
+            if(pipes_count == 3) {
+                name_start = ptr + 1;
+                break;
+            }
+        }
+        ptr++;
+    }
+    if(name_start == NULL) return -10;
+
+    name_end = strchr(name_start, '|');
+    if(name_end != NULL) *name_end = '\0';
+    if(strlen(name_start) > MAX_NAME) return -21;
+    return (int)strlen(name_start);
+}
+
+// the old handle_message: copy the type out, then strchr and atoi the fields
+static int legacy_move(char *buf) {
+    char type[5];
+    char *pile_str, *count_str, *split, *end;
+
+    if(buf[0] != '0') return -10;
+
+    memset(type, 0, sizeof(type));
+    memcpy(type, buf + 5, 4);
+    type[4] = '\0';
+    if(strcmp(type, "OPEN") == 0) return -23;
+    if(strcmp(type, "MOVE") != 0) return -10;
+
+    pile_str = buf + 10;
+    split = strchr(pile_str, '|');
+    if(!split) return -10;
+    *split = '\0';
+    count_str = split + 1;
+    end = strchr(count_str, '|');
+    if(end) *end = '\0';
+
+    return atoi(pile_str) * 100 + atoi(count_str);
+}
+
+// each message went through a zeroed BUF_SIZE buffer it was read into
+static int legacy_parse(const char *frame, int len) {
+    char buf[BUF_SIZE];
+
+    memset(buf, 0, BUF_SIZE);
+    memcpy(buf, frame, len);
+    if(strncmp(buf + 5, "OPEN", 4) == 0) return legacy_open(buf);
+    return legacy_move(buf);
+}
+
+static int new_parse(const char *frame, int len) {
+    NgpMsg m;
+
+    if(ngp_parse(frame, len, &m) != 0) return -10;
+    return m.type == NGP_OPEN ? m.name_len : m.pile * 100 + m.count;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *label, int (*parse)(const char *, int), long rounds, const int *lens) {
+    double start, secs, rate;
+    long r;
+    int i, acc = 0;
+
+    start = now();
+    for(r = 0; r < rounds; r++) {
+        for(i = 0; i < NCORPUS; i++) {
+            acc += parse(corpus[i], lens[i]);
+        }
+    }
+    secs = now() - start;
+    sink = acc;
+
+    rate = rounds * NCORPUS / secs;
+    printf("%-8s %10.0f msgs/sec  (%.1f ns/msg)\n", label, rate, 1e9 / rate);
+    return rate;
+}
+
+int main(int argc, char *argv[]) {
+    long rounds = argc > 1 ? atol(argv[1]) : 2000000;
+    int lens[NCORPUS];
+    double legacy, parsed;
+    int i;
+
+    for(i = 0; i < NCORPUS; i++) {
+        lens[i] = (int)strlen(corpus[i]);
+
+        // both parsers must agree before their speed means anything
+        if(legacy_parse(corpus[i], lens[i]) != new_parse(corpus[i], lens[i])) {
+            fprintf(stderr, "parsers disagree on %s\n", corpus[i]);
+            return 1;
+        }
+    }
+
+    printf("%ld rounds of %d messages\n", rounds, NCORPUS);
+    legacy = run("legacy", legacy_parse, rounds, lens);
+    parsed = run("ngp", new_parse, rounds, lens);
+    printf("speedup  %.2fx\n", parsed / legacy);
+    return 0;
+}
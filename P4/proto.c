@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+#include "nimd.h"
+
+// One player's side of the NGP exchange: what a message means in each state
+// and the replies it earns, apart from how connections are served, so the
+// event loop, the fork mode workers and the fuzz target all run the same code.
+
+int resume_grace_ms;
+
+// check the first message on a new connection, which must be an OPEN
+int parse_open(const char *frame, int len, NgpMsg *m) {
+    int code = ngp_parse(frame, len, m);
+
+    if(code != 0) {
+        return code;
+    }
+
+    // message must be OPEN as the first command on a new connection
+    if(m->type != NGP_OPEN) {
+        return FAIL_INVALID;
+    }
+
+    // a token only means something if this server hands them out
+    if(m->token != NULL && (resume_grace_ms == 0 || ngp_token(m->token, m->token_len) == 0)) {
+        return FAIL_INVALID;
+    }
+
+    return 0;
+}
+
+// any message from a player who is still waiting for an opponent is an error
+int waiting_fail(const char *frame, int len) {
+    NgpMsg m;
+
+    ngp_parse(frame, len, &m);
+
+    // second OPEN on same connection
+    if(m.type == NGP_OPEN) {
+        return FAIL_OPEN;
+    }
+    // MOVE while not in a game yet
+    if(m.type == NGP_MOVE) {
+        return FAIL_NOT_PLAYING;
+    }
+    // any other bad message
+    return FAIL_INVALID;
+}
+
+// apply one message from a player in a game to their board, *m is what it
+// parsed to
+// returns 1 for a valid move, 2 for a rejected move or a SYNC, -1 if the player is out
+// of the game; the caller owns closing the connection
+int apply_message(Board *b, Player *me, int my_id, const char *frame, int len, NgpMsg *m) {
+    int parse_code, code;
+
+    parse_code = ngp_parse(frame, len, m);
+
+    // second OPEN during game is not allowed
+    if(m->type == NGP_OPEN) {
+        send_fail(me, FAIL_OPEN);
+        return -1;
+    }
+
+    // the whole board again, whoever's turn it is
+    if(m->type == NGP_SYNC && parse_code == 0) {
+        broadcast_board(b, me, NULL);
+        return 2;
+    }
+
+    // only MOVE messages are valid here
+    if(m->type != NGP_MOVE) {
+        send_fail(me, FAIL_INVALID);
+        return -1;
+    }
+
+    // check if it is this player's turn
+    if(b->turn != my_id) {
+        send_fail(me, FAIL_IMPATIENT);
+        return 2;
+    }
+
+    // pile and count must both be numbers
+    if(parse_code != 0) {
+        send_fail(me, parse_code);
+        return -1;
+    }
+
+    // check the move and apply it to the board
+    code = board_take(b, m->pile, m->count);
+    if(code != 0) {
+        send_fail(me, code);
+        return 2;
+    }
+    return 1;
+}
+
+// send NAME message telling a player their number and opponent
+void send_name(Player *p, int id, char *opp_name) {
+    char buf[NGP_MAX_FRAME];
+
+    out_push(p, buf, ngp_encode_name(buf, p->in.version, id, opp_name));
+}
+
+// send SESS message with the token a player can resume their game with
+void send_sess(Player *p, unsigned long long token) {
+    char buf[NGP_MAX_FRAME];
+
+    out_push(p, buf, ngp_encode_sess(buf, p->in.version, token));
+}
+
+// the board to one or two players after a move: PLAY, or DLTA for a player who
+// asked for it, each in the version they speak and formatted once per kind
+void broadcast_play(const Board *b, Player *p1, Player *p2) {
+    char buf[4][NGP_MAX_FRAME];
+    int len[4] = { 0, 0, 0, 0 };
+    Player *to[2] = { p1, p2 };
+    int i, k;
+
+    for(i = 0; i < 2; i++) {
+        if(to[i] == NULL) continue;
+        k = to[i]->in.version * 2 + to[i]->delta;
+        if(len[k] == 0) {
+            len[k] = to[i]->delta ? ngp_encode_delta(buf[k], to[i]->in.version, b)
+                                  : ngp_encode_play(buf[k], to[i]->in.version, b);
+        }
+        out_push(to[i], buf[k], len[k]);
+    }
+}
+
+// the whole board, when a game starts or a player comes back or asks: PLAY,
+// or SNAP for a player who gets DLTA
+void broadcast_board(const Board *b, Player *p1, Player *p2) {
+    char buf[4][NGP_MAX_FRAME];
+    int len[4] = { 0, 0, 0, 0 };
+    Player *to[2] = { p1, p2 };
+    int i, k;
+
+    for(i = 0; i < 2; i++) {
+        if(to[i] == NULL) continue;
+        k = to[i]->in.version * 2 + to[i]->delta;
+        if(len[k] == 0) {
+            len[k] = to[i]->delta ? ngp_encode_snap(buf[k], to[i]->in.version, b)
+                                  : ngp_encode_play(buf[k], to[i]->in.version, b);
+        }
+        out_push(to[i], buf[k], len[k]);
+    }
+}
+
+// send OVER message to one or two players
+void send_over(const Board *b, Player *p1, Player *p2, int winner, char *reason) {
+    char buf[2][NGP_MAX_FRAME];
+    int len[2] = { 0, 0 };
+    Player *to[2] = { p1, p2 };
+    int i, v;
+
+    for(i = 0; i < 2; i++) {
+        if(to[i] == NULL) continue;
+        v = to[i]->in.version;
+        if(len[v] == 0) len[v] = ngp_encode_over(buf[v], v, b, winner, reason);
+        out_push(to[i], buf[v], len[v]);
+    }
+}
+
+// tell a player to wait for an opponent
+void send_wait(Player *p) {
+    int len;
+    const char *frame = ngp_wait_frame(p->in.version, &len);
+
+    out_push(p, frame, len);
+}
+
+// send FAIL message, the caller decides whether the connection stays open
+void send_fail(Player *p, int code) {
+    int len;
+    const char *frame = ngp_fail_frame(p->in.version, code, &len);
+
+    out_push(p, frame, len);
+    metrics_fail(code);
+}
+
+enum {
+    SESSION_NEW,
+    SESSION_WAITING,
+    SESSION_PLAYING,
+    SESSION_OVER,
+    SESSION_DONE
+};
+
+// the bot answers for the opponent, who is 3 - id, returns the next state
+static int session_reply(Board *b, Player *me, int id) {
+    const Board *one[1] = { b };
+    BotMove bm;
+
+    bot_plan(one, 1, &bm);
+    board_take(b, bm.pile, bm.count);
+    if(board_winner(b, 3 - id)) {
+        send_over(b, me, NULL, 3 - id, (char *)"");
+        return SESSION_OVER;
+    }
+    b->turn = id;
+    broadcast_play(b, me, NULL);
+    return SESSION_PLAYING;
+}
+
+// Play bytes, as the whole stream of one connection, through the same
+// states conn_pump takes a connection through, in process and with no
+// sockets: the stream goes into me's Framer chunk bytes at a time, replies
+// are queued on me, and the opponent is the bot. With NGP_SESSION_WAIT a
+// frame arrives while the player still waits for a match, with
+// NGP_SESSION_SECOND the player is player 2. Returns the frames handled.
+int ngp_session(Player *me, const char *bytes, int len, int chunk, int flags) {
+    char scratch[NGP_MAX_FRAME];
+    const char *frame;
+    Board board;
+    NgpMsg m;
+    int id = flags & NGP_SESSION_SECOND ? 2 : 1;
+    int state = SESSION_NEW, fed = 0, frames = 0, n, code;
+
+    if(chunk < 1) chunk = 1;
+    // a player whose replies pile up past OUTQ_HIGH_WATER is dropped
+    while(state != SESSION_DONE && !me->out.over) {
+        n = framer_next(&me->in, &frame, scratch);
+        if(n == 0) {
+            if(fed == len) break;
+            fed += framer_push(&me->in, bytes + fed, len - fed < chunk ? len - fed : chunk);
+            continue;
+        }
+        if(n < 0) {
+            // not an NGP stream at all
+            if(state != SESSION_OVER) send_fail(me, FAIL_INVALID);
+            break;
+        }
+        frames++;
+
+        switch(state) {
+        case SESSION_NEW:
+            code = parse_open(frame, n, &m);
+            if(code != 0) {
+                send_fail(me, code);
+                state = SESSION_DONE;
+                break;
+            }
+            memcpy(me->name, m.name, m.name_len);
+            me->name[m.name_len] = '\0';
+            me->delta = m.delta;
+            send_wait(me);
+            if(flags & NGP_SESSION_WAIT) {
+                state = SESSION_WAITING;
+                break;
+            }
+
+            board_init(&board);
+            send_name(me, id, (char *)bot_name);
+            broadcast_board(&board, me, NULL);
+            state = id == 1 ? SESSION_PLAYING : session_reply(&board, me, id);
+            break;
+        case SESSION_WAITING:
+            send_fail(me, waiting_fail(frame, n));
+            state = SESSION_DONE;
+            break;
+        case SESSION_PLAYING:
+            code = apply_message(&board, me, id, frame, n, &m);
+            if(code < 0) {
+                state = SESSION_DONE;
+            } else if(code == 1) {
+                if(board_winner(&board, id)) {
+                    send_over(&board, me, NULL, id, (char *)"");
+                    state = SESSION_OVER;
+                } else {
+                    board.turn = 3 - id;
+                    broadcast_play(&board, me, NULL);
+                    state = session_reply(&board, me, id);
+                }
+            }
+            break;
+        case SESSION_OVER:
+            // game is over, ignore anything else the peer sends
+            break;
+        }
+    }
+    return frames;
+}
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "nimd.h"
+
+// Sprague-Grundy solver for the configured rules, for the variants where the
+// plain nim-sum is wrong: a cap on how many stones a move takes, and misere.
+//
+// Under normal play every pile is an independent game, so one Grundy value
+// per pile size (the mex of the values a move can reach) is enough and the
+// position is lost exactly when their XOR is 0. Misere does not split into
+// piles that way, so it gets a table of every position's outcome, filled once
+// by solve_init before any worker starts and only read after that.
+//
+// Piles are interchangeable, so a position is keyed by its piles sorted, and
+// the sorted piles are ranked in the combinatorial number system: n piles of
+// at most m stones take C(m + n, n) slots rather than (m + 1)^n, one bit each,
+// set if the player to move wins. Every move lowers the rank, so the table is
+// filled in rank order with each position's children already known.
+
+#define SOLVE_MAX_SLOTS (1L << 27)  // biggest table built, 16MB
+#define BINOM_N (255 + MAX_PILES + 1)
+
+static unsigned char grundy[256];
+static uint64_t binom[BINOM_N][MAX_PILES + 1];  // saturates at UINT64_MAX
+static unsigned char *table;
+static long table_slots;
+
+static void binom_init(void) {
+    int n, k;
+
+    for(n = 0; n < BINOM_N; n++) {
+        binom[n][0] = 1;
+        for(k = 1; k <= MAX_PILES; k++) {
+            if(n == 0) {
+                binom[n][k] = 0;
+            } else if(binom[n - 1][k - 1] > UINT64_MAX - binom[n - 1][k]) {
+                binom[n][k] = UINT64_MAX;
+            } else {
+                binom[n][k] = binom[n - 1][k - 1] + binom[n - 1][k];
+            }
+        }
+    }
+}
+
+// slot of a position given its piles in ascending order
+static long rank(const unsigned char *a) {
+    long r = 0;
+    int i;
+
+    for(i = 0; i < rules.npiles; i++) r += binom[a[i] + i][i + 1];
+    return r;
+}
+
+static int slot_won(long r) {
+    return (table[r >> 3] >> (r & 7)) & 1;
+}
+
+static void sort_piles(const Board *b, unsigned char *a) {
+    int i, j;
+    unsigned char v;
+
+    for(i = 0; i < rules.npiles; i++) {
+        v = b->piles[i];
+        for(j = i; j > 0 && a[j - 1] > v; j--) a[j] = a[j - 1];
+        a[j] = v;
+    }
+}
+
+static int most(int pile) {
+    return rules.max_take && rules.max_take < pile ? rules.max_take : pile;
+}
+
+// whether the player to move wins the sorted position a, every position
+// with a lower rank must be solved already
+static int solve_pos(const unsigned char *a) {
+    unsigned char child[MAX_PILES];
+    int i, j, c, n = rules.npiles;
+
+    // with no stones left the previous player took the last one
+    if(a[n - 1] == 0) return rules.misere;
+
+    for(i = 0; i < n; i++) {
+        // equal piles give the same children, try the last of each run
+        if(a[i] == 0 || (i + 1 < n && a[i + 1] == a[i])) continue;
+
+        for(c = 1; c <= most(a[i]); c++) {
+            memcpy(child, a, n);
+            for(j = i; j > 0 && child[j - 1] > a[i] - c; j--) child[j] = child[j - 1];
+            child[j] = a[i] - c;
+
+            if(!slot_won(rank(child))) return 1;
+        }
+    }
+    return 0;
+}
+
+// set up the solver for the current rules, before any thread or worker
+// process starts; returns -1 if misere positions are too many to tabulate,
+// in which case solve_wins answers -1 for them
+int solve_init(void) {
+    unsigned char a[MAX_PILES];
+    unsigned char seen[256 + 1];
+    int n, c, i, top = 0;
+    uint64_t slots;
+    long r;
+
+    // Grundy value of each pile size under the removal cap
+    for(n = 0; n < 256; n++) {
+        memset(seen, 0, sizeof(seen));
+        for(c = 1; c <= most(n); c++) seen[grundy[n - c]] = 1;
+        for(c = 0; seen[c]; c++);
+        grundy[n] = c;
+    }
+
+    free(table);
+    table = NULL;
+    table_slots = 0;
+    if(!rules.misere) return 0;
+
+    binom_init();
+    for(n = 0; n < rules.npiles; n++) {
+        if(rules.start[n] > top) top = rules.start[n];
+    }
+    slots = binom[top + rules.npiles][rules.npiles];
+    if(slots > SOLVE_MAX_SLOTS) return -1;
+
+    table = calloc((slots + 7) / 8, 1);
+    if(table == NULL) return -1;
+    table_slots = slots;
+
+    // walk the sorted positions in rank order: bump the first pile that can
+    // grow without passing the next one and zero the piles below it
+    memset(a, 0, sizeof(a));
+    for(r = 0; r < table_slots; r++) {
+        if(solve_pos(a)) table[r >> 3] |= 1 << (r & 7);
+
+        for(i = 0; i + 1 < rules.npiles && a[i] == a[i + 1]; i++);
+        a[i]++;
+        memset(a, 0, i);
+    }
+    return 0;
+}
+
+// 1 if the player to move can force a win, 0 if not, -1 if the solver can
+// not tell
+int solve_wins(const Board *b) {
+    unsigned char a[MAX_PILES];
+    int i, x = 0;
+
+    if(!rules.misere) {
+        for(i = 0; i < rules.npiles; i++) x ^= grundy[b->piles[i]];
+        return x != 0;
+    }
+    if(table == NULL) return -1;
+
+    sort_piles(b, a);
+    return slot_won(rank(a));
+}
+
+// a winning move for the player to move, returns 0 and some legal move if
+// there is none (or the solver can not tell), the board must not be empty
+int solve_move(const Board *b, BotMove *m) {
+    Board next;
+    int i, c, x = 0;
+
+    if(!rules.misere) {
+        // the pile to move on must go to the Grundy value that zeroes the XOR
+        for(i = 0; i < rules.npiles; i++) x ^= grundy[b->piles[i]];
+        for(i = 0; i < rules.npiles && x != 0; i++) {
+            for(c = 1; c <= most(b->piles[i]); c++) {
+                if(grundy[b->piles[i] - c] == (grundy[b->piles[i]] ^ x)) {
+                    m->pile = i;
+                    m->count = c;
+                    return 1;
+                }
+            }
+        }
+    } else if(table != NULL) {
+        // misere has no such shortcut, look up where each move leads
+        for(i = 0; i < rules.npiles; i++) {
+            for(c = 1; c <= most(b->piles[i]); c++) {
+                next = *b;
+                next.piles[i] -= c;
+                if(solve_wins(&next) == 0) {
+                    m->pile = i;
+                    m->count = c;
+                    return 1;
+                }
+            }
+        }
+    }
+
+    // lost or unknown, take one stone from the biggest pile
+    m->pile = 0;
+    for(i = 1; i < rules.npiles; i++) {
+        if(b->piles[i] > b->piles[m->pile]) m->pile = i;
+    }
+    m->count = 1;
+    return 0;
+}
+
+// memory the misere table takes, 0 if there is none
+long solve_table_bytes(void) {
+    return (table_slots + 7) / 8;
+}
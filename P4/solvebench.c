@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "nimd.h"
+
+// Benchmark for the Sprague-Grundy solver: for each board configuration, how
+// long solve_init takes, how much table it keeps and how fast positions are
+// looked up and answered with a move. Run as
+// ./solvebench [piles[:max_take][:m] ...], e.g. ./solvebench 1,3,5,7,9:3:m
+
+static const char *defaults[] = {
+    "1,3,5,7,9",
+    "1,3,5,7,9:3",
+    "1,3,5,7,9:m",
+    "1,3,5,7,9:3:m",
+    "3,5,7,9,11,13,15:4:m",
+    "10,10,10,10,10,10,10,10:m",
+    "20,20,20,20,20,20,20,20:5:m",
+    "30,30,30,30,30,30:7:m",
+};
+
+#define NDEFAULTS ((int)(sizeof(defaults) / sizeof(defaults[0])))
+#define NPOS 4096
+#define ROUNDS 256
+
+static volatile int sink;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// configure the rules from "piles[:max_take][:m]", returns -1 if malformed
+static int configure(const char *spec) {
+    char piles[256];
+    const char *colon = strchr(spec, ':');
+    int max_take = 0, misere = 0;
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+    if(len >= sizeof(piles)) return -1;
+    memcpy(piles, spec, len);
+    piles[len] = '\0';
+
+    while(colon != NULL) {
+        spec = colon + 1;
+        colon = strchr(spec, ':');
+        if(*spec == 'm') misere = 1;
+        else if((max_take = atoi(spec)) < 1) return -1;
+    }
+    return board_configure(piles, misere, max_take);
+}
+
+static void bench(const char *spec) {
+    static Board boards[NPOS];
+    BotMove m;
+    double start, init, wins, moves;
+    int i, j, r, acc = 0;
+
+    if(configure(spec) == -1) {
+        fprintf(stderr, "bad configuration %s\n", spec);
+        return;
+    }
+
+    start = now();
+    if(solve_init() == -1) {
+        printf("%-30s too many positions to solve\n", spec);
+        return;
+    }
+    init = now() - start;
+
+    // random positions the game can reach, none of them empty
+    srand(1);
+    for(i = 0; i < NPOS; i++) {
+        do {
+            board_init(&boards[i]);
+            boards[i].stones = 0;
+            for(j = 0; j < rules.npiles; j++) {
+                boards[i].piles[j] = rand() % (rules.start[j] + 1);
+                boards[i].stones += boards[i].piles[j];
+            }
+        } while(boards[i].stones == 0);
+    }
+
+    start = now();
+    for(r = 0; r < ROUNDS; r++) {
+        for(i = 0; i < NPOS; i++) acc += solve_wins(&boards[i]);
+    }
+    wins = ROUNDS * NPOS / (now() - start);
+
+    start = now();
+    for(r = 0; r < ROUNDS; r++) {
+        for(i = 0; i < NPOS; i++) acc += solve_move(&boards[i], &m);
+    }
+    moves = ROUNDS * NPOS / (now() - start);
+    sink = acc;
+
+    printf("%-30s %9.1f ms %10ld bytes %12.0f lookups/sec %12.0f moves/sec\n",
+           spec, init * 1e3, solve_table_bytes(), wins, moves);
+}
+
+int main(int argc, char *argv[]) {
+    int i;
+
+    if(argc > 1) {
+        for(i = 1; i < argc; i++) bench(argv[i]);
+    } else {
+        for(i = 0; i < NDEFAULTS; i++) bench(defaults[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nimd.h"
+
+// Checks the Sprague-Grundy solver (solve.c) against plain game-tree search.
+// For each board, cap and play mode, every position with piles no bigger than
+// the start is solved by brute force over the unsorted piles: solve_wins must
+// agree with it, and solve_move must find a legal move to a lost position
+// exactly when the position is won. A misere board too big to tabulate must
+// leave solve_wins at -1 and solve_move with a legal move. Run as ./solvetest,
+// it exits 1 if anything disagrees.
+
+static const char *boards[] = {
+    "6,5,6,4",
+    "1,3,5,7,9",
+    "12,1,9",
+    "16",
+    "3,3,3,3,3,3,3",
+    "2,2,2,2,2,2,2,2,2,2",
+};
+
+#define NBOARDS ((int)(sizeof(boards) / sizeof(boards[0])))
+#define MAX_CAP 4
+
+static signed char *memo;   // per position, 1 won, 0 lost, -1 not known yet
+static long radix[MAX_PILES];
+static int failures;
+
+static long index_of(const Board *b) {
+    long at = 0;
+    int i;
+
+    for(i = 0; i < rules.npiles; i++) at += b->piles[i] * radix[i];
+    return at;
+}
+
+// whether the player to move wins b, by trying every move
+static int brute_wins(const Board *b) {
+    Board next;
+    long at = index_of(b);
+    int i, c, won = 0;
+
+    if(memo[at] >= 0) return memo[at];
+
+    // with no stones left the previous player took the last one
+    if(b->stones == 0) {
+        won = rules.misere;
+    } else {
+        for(i = 0; i < rules.npiles && !won; i++) {
+            for(c = 1; c <= b->piles[i] && !won; c++) {
+                if(rules.max_take && c > rules.max_take) break;
+                next = *b;
+                next.piles[i] -= c;
+                next.stones -= c;
+                won = !brute_wins(&next);
+            }
+        }
+    }
+    memo[at] = won;
+    return won;
+}
+
+static void report(const char *spec, int cap, const Board *b, const char *what) {
+    char piles[MAX_PILES * 4 + 1];
+
+    *board_render(b, piles) = '\0';
+    fprintf(stderr, "%s cap %d %s: [%s] %s\n", spec, cap, rules.misere ? "misere" : "normal",
+            piles, what);
+    failures++;
+}
+
+// a legal move from b, checked the way the server checks one
+static int legal(const Board *b, const BotMove *m) {
+    Board next = *b;
+
+    return board_take(&next, m->pile, m->count) == 0;
+}
+
+// check every position of spec under cap and mode, returns how many
+static long check(const char *spec, int cap, int misere) {
+    Board b, next;
+    BotMove m;
+    long positions = 1, at;
+    int i, won, found;
+
+    if(board_configure(spec, misere, cap) != 0 || solve_init() != 0) {
+        fprintf(stderr, "%s cap %d: solver would not set up\n", spec, cap);
+        failures++;
+        return 0;
+    }
+
+    for(i = 0; i < rules.npiles; i++) {
+        radix[i] = positions;
+        positions *= rules.start[i] + 1;
+    }
+    memo = malloc(positions);
+    if(memo == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    memset(memo, -1, positions);
+
+    for(at = 0; at < positions; at++) {
+        board_init(&b);
+        b.stones = 0;
+        for(i = 0; i < rules.npiles; i++) {
+            b.piles[i] = at / radix[i] % (rules.start[i] + 1);
+            b.stones += b.piles[i];
+        }
+
+        won = brute_wins(&b);
+        if(solve_wins(&b) != won) report(spec, cap, &b, won ? "is won" : "is lost");
+        if(b.stones == 0) continue;
+
+        found = solve_move(&b, &m);
+        if(!legal(&b, &m)) {
+            report(spec, cap, &b, "got an illegal move");
+        } else if(found != won) {
+            report(spec, cap, &b, won ? "found no winning move" : "found a winning move");
+        } else if(found) {
+            next = b;
+            board_take(&next, m.pile, m.count);
+            if(brute_wins(&next)) report(spec, cap, &b, "moved to a won position");
+        }
+    }
+
+    free(memo);
+    return positions;
+}
+
+// a misere table past SOLVE_MAX_SLOTS is not built, the solver says so and
+// still moves
+static void check_fallback(void) {
+    Board b;
+    BotMove m;
+
+    if(board_configure("35,35,35,35,35,35,35,35", 1, 0) != 0) return;
+    board_init(&b);
+    if(solve_init() != -1 || solve_table_bytes() != 0) {
+        fprintf(stderr, "8 piles of 35 misere: table built past the limit\n");
+        failures++;
+    }
+    if(solve_wins(&b) != -1) {
+        fprintf(stderr, "8 piles of 35 misere: answered without a table\n");
+        failures++;
+    }
+    if(solve_move(&b, &m) != 0 || !legal(&b, &m)) {
+        fprintf(stderr, "8 piles of 35 misere: no legal fallback move\n");
+        failures++;
+    }
+}
+
+int main(void) {
+    long positions = 0;
+    int i, cap, misere;
+
+    for(i = 0; i < NBOARDS; i++) {
+        for(cap = 0; cap <= MAX_CAP; cap++) {
+            for(misere = 0; misere < 2; misere++) positions += check(boards[i], cap, misere);
+        }
+    }
+    check_fallback();
+
+    printf("Solver: %s (%ld positions, %d boards, caps 0-%d, normal and misere)\n",
+           failures ? "FAIL" : "PASS", positions, NBOARDS, MAX_CAP);
+    return failures ? 1 : 0;
+}
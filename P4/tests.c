@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -9,180 +10,813 @@
 #include <netdb.h>
 #include <poll.h>
 #include <errno.h>
+#include "nimd.h"
 
-#define BUF_SIZE 1024
+// Conformance tests for a running nimd. Every reply is read as a whole NGP
+// frame with a deadline, so a check passes as soon as its frame is in and
+// only fails once the server has had DEADLINE_MS to answer. Scenarios run at
+// once, one thread each, with names no other run uses; the server pairs
+// whoever waits in arrival order, so a scenario holds queue_lock from its
+// first OPEN until its own players are matched or gone. The busy test fills
+// every game slot, so it runs alone after the others. Scenarios for a server
+// option run when tests is given the same setting, and are skipped otherwise.
 
-// Connect to server
-int connect_to_server(const char *hostname, const char *port) {
-    int sockfd;
-    struct addrinfo hints, *servinfo, *info;
+#define DEADLINE_MS 2000    // longest any reply may take
+#define BUSY_PAIRS 256      // games the busy test starts before it gives up
+#define EARLY_MS 20         // how much sooner a deadline may pass, the server arms
+                            // them from the start of its loop round
+#define TOKEN_LEN 16        // hex digits in a SESS token
 
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
+enum { SKIP = -1, FAIL, PASS };
 
-    if(getaddrinfo(hostname, port, &hints, &servinfo) != 0) return -1;
+typedef struct {
+    int fd;
+    Framer in;
+    char name[MAX_NAME + 1];
+    char token[TOKEN_LEN + 1];  // from the last SESS, with -R
+    char frame[NGP_MAX_FRAME + 1];  // the last frame read
+    int len;                        // its length
+} Peer;
 
-    for(info = servinfo; info != NULL; info = info->ai_next) {
-        if((sockfd = socket(info->ai_family, info->ai_socktype, info->ai_protocol)) == -1) continue;
-        if(connect(sockfd, info->ai_addr, info->ai_addrlen) == -1) {
-            close(sockfd);
-            continue;
+static const char *host, *port;
+static int max_take;        // the server's -k
+static int open_ms, turn_ms, idle_ms;   // its -O, -T and -I
+static int resume_ms;       // its -R
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *titles[] = {
+    NULL,
+    "Test 1 (Error 10)",
+    "Test 2 (Error 21)",
+    "Test 3 (Error 23)",
+    "Test 4 (Error 24)",
+    "Test 5 (Error 22)",
+    "Test 6 (Error 31)",
+    "Test 7 (Error 32)",
+    "Test 8 (Error 33)",
+    "Test 9 (Full game)",
+    "Test 10 (Forfeit)",
+    "Test 11 (Pipelined frames)",
+    "Test 12 (Error 20)",
+    "Test 13 (NGP v1 against v0)",
+    "Test 14 (Delta updates)",
+    "Test 15 (Error 33 past -k)",
+    "Test 16 (OPEN timeout)",
+    "Test 17 (Turn timeout)",
+    "Test 18 (Idle timeout)",
+    "Test 19 (Resume)",
+    "Test 20 (Stale tokens)",
+    "Test 21 (Resume timeout)",
+};
+#define NTESTS (int)(sizeof(titles) / sizeof(titles[0]) - 1)
+
+static int results[NTESTS + 1];
+
+// connect as name, made unique to this run; returns 0 if there is no server
+static int peer_connect(Peer *p, const char *name) {
+    memset(p, 0, sizeof(*p));
+    snprintf(p->name, sizeof(p->name), "%s.%d", name, (int)getpid());
+    p->fd = connect_to_server(host, port);
+    return p->fd >= 0;
+}
+
+static void peer_open(Peer *p) {
+    char body[NGP_MAX_FRAME];
+
+    snprintf(body, sizeof(body), "OPEN|%s|", p->name);
+    send_ngp(p->fd, body);
+}
+
+static void peer_close(Peer *p) {
+    if(p->fd >= 0) close(p->fd);
+    p->fd = -1;
+}
+
+// the last frame is SESS with a token, which p keeps
+static int is_sess(Peer *p) {
+    const char *body = p->frame + NGP_HDR_LEN;
+
+    if(p->len != NGP_HDR_LEN + 6 + TOKEN_LEN || strncmp(body, "SESS|", 5) != 0) return 0;
+    memcpy(p->token, body + 5, TOKEN_LEN);
+    p->token[TOKEN_LEN] = '\0';
+    return 1;
+}
+
+// the next frame's body starts with prefix, read within ms; a SESS frame,
+// which only a server with -R sends, is kept and skipped
+static int expect_in(Peer *p, const char *prefix, int ms) {
+    long long deadline = deadline_in(ms);
+    int n;
+
+    do {
+        n = p->len = read_frame(p->fd, &p->in, p->frame, deadline);
+        if(n <= 0) return 0;
+    } while(is_sess(p));
+
+    return strncmp(p->frame + NGP_HDR_LEN, prefix, strlen(prefix)) == 0;
+}
+
+static int expect(Peer *p, const char *prefix) {
+    return expect_in(p, prefix, DEADLINE_MS);
+}
+
+// the OVER a walkout ends in, which with -R waits out the grace period
+static int expect_walkout(Peer *p, const char *prefix) {
+    return expect_in(p, prefix, resume_ms + DEADLINE_MS) && strstr(p->frame, "|Forfeit|") != NULL;
+}
+
+// connect p again and OPEN with its token and mode (e.g. "DELTA|") until
+// the reply starts with want; FAIL 22 may only mean the server has not yet
+// seen the player the token belongs to leave, so it is tried again
+static int reopen(Peer *p, const char *mode, const char *want) {
+    char body[NGP_MAX_FRAME];
+    long long deadline = deadline_in(DEADLINE_MS);
+
+    snprintf(body, sizeof(body), "OPEN|%s|%s|%s", p->name, p->token, mode);
+    for(;;) {
+        peer_close(p);
+        memset(&p->in, 0, sizeof(p->in));
+        p->len = 0;
+        p->fd = connect_to_server(host, port);
+        if(p->fd < 0) return 0;
+
+        send_ngp(p->fd, body);
+        if(expect(p, want)) return 1;
+        if(p->len <= 0 || strncmp(p->frame + NGP_HDR_LEN, "FAIL|22|", 8) != 0 ||
+           deadline_in(0) > deadline) {
+            return 0;
         }
-        break;
+        usleep(1000);
     }
+}
 
-    freeaddrinfo(servinfo);
-    return (info == NULL) ? -1 : sockfd;
+// the server closes p's connection, or shuts its side of it, not before
+// at_least ms from start and within DEADLINE_MS of that
+static int closed_after(Peer *p, long long start, int at_least) {
+    if(read_frame(p->fd, &p->in, p->frame, start + at_least + DEADLINE_MS) != 0) return 0;
+    return deadline_in(0) - start >= at_least - EARLY_MS;
 }
 
-void send_raw(int fd, const char *msg) {
-    write(fd, msg, strlen(msg));
+// the next frame is a binary v1 frame of type, SESS skipped as for expect
+static int expect_v1(Peer *p, int type) {
+    long long deadline = deadline_in(DEADLINE_MS);
+
+    do {
+        p->len = read_frame(p->fd, &p->in, p->frame, deadline);
+        if(p->len <= NGP1_HDR_LEN) return 0;
+    } while(p->frame[2] == NGP1_SESS);
+
+    return p->frame[2] == type;
 }
 
-// Send formatted NGP message
-void send_ngp(int fd, const char *body) {
-    char msg[BUF_SIZE];
-    snprintf(msg, sizeof(msg), "0|%02lu|%s", strlen(body), body);
-    write(fd, msg, strlen(msg));
+// the last frame is a v1 PLAY for turn with the n piles
+static int v1_play_is(const Peer *p, int turn, const int *piles, int n) {
+    int i;
+
+    if(p->len != NGP1_HDR_LEN + 2 + n || p->frame[3] != turn) return 0;
+    for(i = 0; i < n; i++) {
+        if((unsigned char)p->frame[4 + i] != piles[i]) return 0;
+    }
+    return 1;
 }
 
-// Read until expected string found or timeout
-int expect_response(int fd, const char *expected) {
-    char buf[4096] = {0}; 
-    int len = 0;
+// a and b OPEN one after the other and get each other, a is player 1; every
+// OPEN is answered WAIT before the match
+static int pair_up(Peer *a, Peer *b) {
+    char want[NGP_MAX_FRAME];
+    int ok;
 
-    // Try 10 times (1s total)
-    for(int i = 0; i < 10; i++) {
-        int n = recv(fd, buf + len, sizeof(buf) - len - 1, MSG_DONTWAIT);
-        if(n > 0) len += n; 
-        if(strstr(buf, expected)) return 1; 
-        usleep(100000); 
+    pthread_mutex_lock(&queue_lock);
+    peer_open(a);
+    ok = expect(a, "WAIT|");
+    if(ok) {
+        peer_open(b);
+        snprintf(want, sizeof(want), "NAME|1|%s|", b->name);
+        ok = expect(a, want);
+        snprintf(want, sizeof(want), "NAME|2|%s|", a->name);
+        ok = ok && expect(b, "WAIT|") && expect(b, want);
     }
-    return 0;
+    pthread_mutex_unlock(&queue_lock);
+    return ok;
+}
+
+// the piles of the board in the last frame, a PLAY or OVER
+static int board_of(const Peer *p, int *piles) {
+    const char *s = p->frame + NGP_HDR_LEN + 7;
+    char *end;
+    int n = 0;
+
+    while(n < MAX_PILES && *s >= '0' && *s <= '9') {
+        piles[n++] = strtol(s, &end, 10);
+        s = *end == ' ' ? end + 1 : end;
+    }
+    return n;
 }
 
-void run_test_10(const char *host, const char *port) {
-    int fd = connect_to_server(host, port);
-    if(fd < 0) { printf("Test 1 (Error 10): FAIL\n"); return; }
-    
+static void run_test_10(void) {
+    Peer p, q;
+
     // Bad Start Char
-    send_raw(fd, "X|99|GARBAGE|");
-    close(fd); 
+    if(!peer_connect(&p, "Garbage")) return;
+    send_raw(p.fd, "X|99|GARBAGE|");
 
     // Bad Format
-    fd = connect_to_server(host, port);
-    send_raw(fd, "0|00|BADFORMAT|");
-    
-    if(expect_response(fd, "FAIL|10")) printf("Test 1 (Error 10): PASS\n");
-    else printf("Test 1 (Error 10): FAIL\n");
-    close(fd);
-}
+    if(!peer_connect(&q, "BadFormat")) return;
+    send_raw(q.fd, "0|00|BADFORMAT|");
 
-void run_test_21(const char *host, const char *port) {
-    int fd = connect_to_server(host, port);
+    results[1] = expect(&p, "FAIL|10|") && expect(&q, "FAIL|10|");
+    peer_close(&p);
+    peer_close(&q);
+}
 
+static void run_test_21(void) {
+    Peer p;
     char long_name[80];
+    char body[100];
+
+    if(!peer_connect(&p, "LongName")) return;
     memset(long_name, 'A', 73);
     long_name[73] = '\0';
-    
-    char body[100];
     snprintf(body, sizeof(body), "OPEN|%s|", long_name);
-    
-    send_ngp(fd, body);
-    if(expect_response(fd, "FAIL|21")) printf("Test 2 (Error 21): PASS\n");
-    else printf("Test 2 (Error 21): FAIL\n");
-    close(fd);
-}
-
-void run_test_23(const char *host, const char *port) {
-    int fd = connect_to_server(host, port);
-
-    send_ngp(fd, "OPEN|DoubleOpen|");
-    expect_response(fd, "WAIT"); 
-    
-    send_ngp(fd, "OPEN|DoubleOpen|");
-    if(expect_response(fd, "FAIL|23")) printf("Test 3 (Error 23): PASS\n");
-    else printf("Test 3 (Error 23): FAIL\n");
-    close(fd);
-}
-
-void run_test_24(const char *host, const char *port) {
-    int fd = connect_to_server(host, port);
-
-    send_ngp(fd, "OPEN|Early|");
-    expect_response(fd, "WAIT"); 
-    
-    send_ngp(fd, "MOVE|1|1|");
-    if(expect_response(fd, "FAIL|24")) printf("Test 4 (Error 24): PASS\n");
-    else printf("Test 4 (Error 24): FAIL\n");
-    close(fd);
-}
-
-void run_test_22(const char *host, const char *port) {
-    int fd1 = connect_to_server(host, port);
-    send_ngp(fd1, "OPEN|OccupiedName|");
-    expect_response(fd1, "WAIT");
-
-    int fd2 = connect_to_server(host, port);
-    send_ngp(fd2, "OPEN|OccupiedName|");
-    
-    if(expect_response(fd2, "FAIL|22")) printf("Test 5 (Error 22): PASS\n");
-    else printf("Test 5 (Error 22): FAIL\n");
-    
-    close(fd1);
-    close(fd2);
-}
-
-void game_errors(const char *host, const char *port) {
-    int p1 = connect_to_server(host, port);
-    int p2 = connect_to_server(host, port);
-
-    if(p1 < 0 || p2 < 0) {
-        printf("Test 6 (Error 31): FAIL\nTest 7 (Error 32): FAIL\nTest 8 (Error 33): FAIL\n");
+
+    send_ngp(p.fd, body);
+    results[2] = expect(&p, "FAIL|21|");
+    peer_close(&p);
+}
+
+static void run_test_23(void) {
+    Peer p;
+
+    if(!peer_connect(&p, "DoubleOpen")) return;
+
+    // the server closes the connection, so it leaves the queue by itself
+    pthread_mutex_lock(&queue_lock);
+    peer_open(&p);
+    if(expect(&p, "WAIT|")) {
+        peer_open(&p);
+        results[3] = expect(&p, "FAIL|23|");
+    }
+    pthread_mutex_unlock(&queue_lock);
+    peer_close(&p);
+}
+
+static void run_test_24(void) {
+    Peer p;
+
+    if(!peer_connect(&p, "Early")) return;
+
+    pthread_mutex_lock(&queue_lock);
+    peer_open(&p);
+    if(expect(&p, "WAIT|")) {
+        send_ngp(p.fd, "MOVE|1|1|");
+        results[4] = expect(&p, "FAIL|24|");
+    }
+    pthread_mutex_unlock(&queue_lock);
+    peer_close(&p);
+}
+
+static void run_test_22(void) {
+    Peer p1, p2, p3;
+
+    if(!peer_connect(&p1, "OccupiedName") || !peer_connect(&p2, "OccupiedName") ||
+       !peer_connect(&p3, "OccupiedPartner")) {
         return;
     }
 
-    send_ngp(p1, "OPEN|Player1|");
-    expect_response(p1, "WAIT"); 
-    send_ngp(p2, "OPEN|Player2|");
-    
+    // the waiting player gets a partner of its own before the queue is free
+    pthread_mutex_lock(&queue_lock);
+    peer_open(&p1);
+    if(expect(&p1, "WAIT|")) {
+        peer_open(&p2);
+        results[5] = expect(&p2, "FAIL|22|");
+    }
+    peer_open(&p3);
+    expect(&p1, "NAME|");
+    expect(&p3, "WAIT|");
+    expect(&p3, "NAME|");
+    pthread_mutex_unlock(&queue_lock);
+
+    peer_close(&p1);
+    peer_close(&p2);
+    peer_close(&p3);
+}
+
+static void game_errors(void) {
+    Peer p1, p2;
+
+    if(!peer_connect(&p1, "Player1") || !peer_connect(&p2, "Player2")) return;
+
     // Ensure game started
-    if(!expect_response(p1, "PLAY") || !expect_response(p2, "PLAY")) {
-        printf("Test 6 (Error 31): FAIL\nTest 7 (Error 32): FAIL\nTest 8 (Error 33): FAIL\n");
-        close(p1); close(p2);
+    if(!pair_up(&p1, &p2) || !expect(&p1, "PLAY|1|") || !expect(&p2, "PLAY|1|")) {
+        peer_close(&p1);
+        peer_close(&p2);
         return;
     }
 
     // Test 6: Move out of turn (Error 31)
-    send_ngp(p2, "MOVE|0|1|");
-    if(expect_response(p2, "FAIL|31")) printf("Test 6 (Error 31): PASS\n");
-    else printf("Test 6 (Error 31): FAIL\n");
+    send_ngp(p2.fd, "MOVE|0|1|");
+    results[6] = expect(&p2, "FAIL|31|");
 
     // Test 7: Invalid pile (Error 32)
-    send_ngp(p1, "MOVE|5|1|");
-    if(expect_response(p1, "FAIL|32")) printf("Test 7 (Error 32): PASS\n");
-    else printf("Test 7 (Error 32): FAIL\n");
+    send_ngp(p1.fd, "MOVE|99|1|");
+    results[7] = expect(&p1, "FAIL|32|");
+
+    // Test 8: Invalid quantity (Error 33), more than any pile holds
+    send_ngp(p1.fd, "MOVE|0|999|");
+    results[8] = expect(&p1, "FAIL|33|");
+
+    peer_close(&p1);
+    peer_close(&p2);
+}
+
+// both players take one stone at a time from the first pile that has one,
+// checking every PLAY against their own copy of the board, until OVER
+static void full_game(void) {
+    Peer p[2];
+    int piles[MAX_PILES], seen[MAX_PILES];
+    int n, i, turn = 1, pile, moves = 0;
+    char body[NGP_MAX_FRAME], want[32];
+
+    if(!peer_connect(&p[0], "Full1") || !peer_connect(&p[1], "Full2")) return;
+    if(!pair_up(&p[0], &p[1]) || !expect(&p[0], "PLAY|1|") || !expect(&p[1], "PLAY|1|")) {
+        goto done;
+    }
+    n = board_of(&p[0], piles);
+
+    for(;;) {
+        for(pile = 0; pile < n && piles[pile] == 0; pile++);
+        if(pile == n) goto done;    // no OVER for an empty board
+        piles[pile]--;
+        moves++;
+
+        snprintf(body, sizeof(body), "MOVE|%d|1|", pile);
+        send_ngp(p[turn - 1].fd, body);
+
+        // the board is empty after the last stone, so the game is over
+        for(i = 0; i < n && piles[i] == 0; i++);
+        if(i == n) break;
+
+        turn = 3 - turn;
+        snprintf(want, sizeof(want), "PLAY|%d|", turn);
+        for(i = 0; i < 2; i++) {
+            if(!expect(&p[i], want) || board_of(&p[i], seen) != n ||
+               memcmp(seen, piles, n * sizeof(*piles)) != 0) {
+                goto done;
+            }
+        }
+    }
+
+    results[9] = moves > 0 && expect(&p[0], "OVER|") && expect(&p[1], "OVER|") &&
+                 strcmp(p[0].frame, p[1].frame) == 0;
+done:
+    peer_close(&p[0]);
+    peer_close(&p[1]);
+}
+
+// player 1 walks out mid-game, player 2 wins by forfeit
+static void forfeit(void) {
+    Peer p1, p2;
+
+    if(!peer_connect(&p1, "Quitter") || !peer_connect(&p2, "Stayer")) return;
+    if(pair_up(&p1, &p2) && expect(&p1, "PLAY|1|") && expect(&p2, "PLAY|1|")) {
+        peer_close(&p1);
+        results[10] = expect_walkout(&p2, "OVER|2|");
+    }
+    peer_close(&p1);
+    peer_close(&p2);
+}
+
+// player 1 sends two MOVEs in one write, the second out of turn, and player
+// 2 sends its MOVE split across two writes
+static void pipelined(void) {
+    Peer p1, p2;
+    int before[MAX_PILES], after[MAX_PILES];
+    int n;
+
+    if(!peer_connect(&p1, "Pipe1") || !peer_connect(&p2, "Pipe2")) return;
+    if(!pair_up(&p1, &p2) || !expect(&p1, "PLAY|1|") || !expect(&p2, "PLAY|1|")) goto done;
+    n = board_of(&p1, before);
+    if(n < 2 || before[0] < 1 || before[1] < 2) goto done;
+
+    send_raw(p1.fd, "0|09|MOVE|0|1|0|09|MOVE|1|1|");
+    if(!expect(&p1, "PLAY|2|") || !expect(&p1, "FAIL|31|") || !expect(&p2, "PLAY|2|") ||
+       board_of(&p2, after) != n || after[0] != before[0] - 1) {
+        goto done;
+    }
+
+    send_raw(p2.fd, "0|09|MO");
+    usleep(1000);
+    send_raw(p2.fd, "VE|1|1|");
+    results[11] = expect(&p1, "PLAY|1|") && expect(&p2, "PLAY|1|") &&
+                  board_of(&p1, before) == n && before[1] == after[1] - 1;
+done:
+    peer_close(&p1);
+    peer_close(&p2);
+}
+
+// player 1 speaks v0 and player 2 binary v1 in one game, each hearing every
+// move in its own version, then player 2 walks out; a v1 OPEN with a name a
+// v0 opponent could not be sent is refused
+static void mixed_versions(void) {
+    Peer p1, p2, bad;
+    int piles[MAX_PILES], seen[MAX_PILES];
+    char frame[NGP_MAX_FRAME], want[NGP_MAX_FRAME];
+    int n, ok;
+
+    if(!peer_connect(&p1, "Text") || !peer_connect(&p2, "Binary") ||
+       !peer_connect(&bad, "Bad")) {
+        return;
+    }
+
+    send_frame(bad.fd, frame, ngp_encode_open(frame, 1, "Pipe|Name", 0));
+    ok = expect_v1(&bad, NGP1_FAIL) && bad.frame[3] == FAIL_INVALID;
+
+    pthread_mutex_lock(&queue_lock);
+    peer_open(&p1);
+    ok = ok && expect(&p1, "WAIT|");
+    if(ok) {
+        send_frame(p2.fd, frame, ngp_encode_open(frame, 1, p2.name, 0));
+        snprintf(want, sizeof(want), "NAME|1|%s|", p2.name);
+        ok = expect(&p1, want) && expect_v1(&p2, NGP1_WAIT) && expect_v1(&p2, NGP1_NAME) &&
+             p2.frame[3] == 2 && p2.len == NGP1_HDR_LEN + 2 + (int)strlen(p1.name) &&
+             memcmp(p2.frame + 4, p1.name, strlen(p1.name)) == 0;
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    ok = ok && expect(&p1, "PLAY|1|");
+    n = board_of(&p1, piles);
+    ok = ok && n >= 2 && piles[0] >= 1 && piles[1] >= 1 &&
+         expect_v1(&p2, NGP1_PLAY) && v1_play_is(&p2, 1, piles, n);
+
+    // a v0 move, then a v1 one, then a v1 one out of turn
+    if(ok) {
+        send_ngp(p1.fd, "MOVE|0|1|");
+        piles[0]--;
+        ok = expect(&p1, "PLAY|2|") && expect_v1(&p2, NGP1_PLAY) && v1_play_is(&p2, 2, piles, n);
+    }
+    if(ok) {
+        send_frame(p2.fd, frame, ngp_encode_move(frame, 1, 1, 1));
+        piles[1]--;
+        ok = expect(&p1, "PLAY|1|") && board_of(&p1, seen) == n &&
+             memcmp(seen, piles, n * sizeof(*piles)) == 0 &&
+             expect_v1(&p2, NGP1_PLAY) && v1_play_is(&p2, 1, piles, n);
+    }
+    if(ok) {
+        send_frame(p2.fd, frame, ngp_encode_move(frame, 1, 1, 1));
+        ok = expect_v1(&p2, NGP1_FAIL) && p2.frame[3] == FAIL_IMPATIENT;
+    }
+    if(ok) {
+        peer_close(&p2);
+        results[13] = expect_walkout(&p1, "OVER|1|");
+    }
+
+    peer_close(&p1);
+    peer_close(&p2);
+    peer_close(&bad);
+}
+
+// both players ask for DLTA, player 1 in v0 and player 2 in v1: the game
+// starts with SNAP, each move comes as the one pile it changed, and SYNC
+// gets the whole board again
+static void delta_updates(void) {
+    Peer p1, p2;
+    int piles[MAX_PILES];
+    char frame[NGP_MAX_FRAME], want[NGP_MAX_FRAME];
+    int n = 0, i, ok;
+
+    if(!peer_connect(&p1, "DeltaText") || !peer_connect(&p2, "DeltaBinary")) return;
+
+    pthread_mutex_lock(&queue_lock);
+    send_frame(p1.fd, frame, ngp_encode_open(frame, 0, p1.name, NGP_OPEN_DELTA));
+    ok = expect(&p1, "WAIT|");
+    if(ok) {
+        send_frame(p2.fd, frame, ngp_encode_open(frame, 1, p2.name, NGP_OPEN_DELTA));
+        ok = expect(&p1, "NAME|1|") && expect_v1(&p2, NGP1_WAIT) && expect_v1(&p2, NGP1_NAME);
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    // SNAP, player 1 to move, seq 0
+    ok = ok && expect(&p1, "SNAP|1|0|") && expect_v1(&p2, NGP1_SNAP) && p2.frame[3] == 1 &&
+         p2.frame[4] == 0 && p2.frame[5] == 0;
+    if(ok) {
+        n = p2.len - 6;
+        for(i = 0; i < n; i++) piles[i] = (unsigned char)p2.frame[6 + i];
+        ok = n >= 2 && piles[0] >= 1 && piles[1] >= 1;
+    }
+
+    if(ok) {
+        send_ngp(p1.fd, "MOVE|0|1|");
+        snprintf(want, sizeof(want), "DLTA|2|1|0|%d|", piles[0] - 1);
+        ok = expect(&p1, want) && p1.len == (int)(NGP_HDR_LEN + strlen(want)) &&
+             expect_v1(&p2, NGP1_DLTA) && p2.len == 8 && p2.frame[3] == 2 &&
+             p2.frame[5] == 1 && p2.frame[6] == 0 && p2.frame[7] == piles[0] - 1;
+        piles[0]--;
+    }
+    if(ok) {
+        send_frame(p2.fd, frame, ngp_encode_sync(frame, 1));
+        ok = expect_v1(&p2, NGP1_SNAP) && p2.len == 6 + n && p2.frame[3] == 2 &&
+             p2.frame[5] == 1 && p2.frame[6] == piles[0];
+    }
+    if(ok) {
+        send_frame(p2.fd, frame, ngp_encode_move(frame, 1, 1, 1));
+        snprintf(want, sizeof(want), "DLTA|1|2|1|%d|", piles[1] - 1);
+        ok = expect(&p1, want) && expect_v1(&p2, NGP1_DLTA) && p2.frame[3] == 1;
+    }
+    if(ok) {
+        send_ngp(p1.fd, "SYNC|");
+        results[14] = expect(&p1, "SNAP|1|2|");
+    }
+
+    peer_close(&p1);
+    peer_close(&p2);
+}
+
+// with -k, a move within a pile but past the cap is refused and one at the
+// cap goes through
+static void move_cap(void) {
+    Peer p1, p2;
+    int piles[MAX_PILES];
+    char body[NGP_MAX_FRAME];
+    int n, pile;
+
+    results[15] = SKIP;
+    if(max_take == 0) return;
+    results[15] = FAIL;
+
+    if(!peer_connect(&p1, "Capped1") || !peer_connect(&p2, "Capped2")) return;
+    if(!pair_up(&p1, &p2) || !expect(&p1, "PLAY|1|") || !expect(&p2, "PLAY|1|")) goto done;
+    n = board_of(&p1, piles);
+    for(pile = 0; pile < n && piles[pile] <= max_take; pile++);
+    if(pile == n) goto done;    // no pile is over the cap to test with
+
+    snprintf(body, sizeof(body), "MOVE|%d|%d|", pile, max_take + 1);
+    send_ngp(p1.fd, body);
+    if(!expect(&p1, "FAIL|33|")) goto done;
+
+    snprintf(body, sizeof(body), "MOVE|%d|%d|", pile, max_take);
+    send_ngp(p1.fd, body);
+    results[15] = expect(&p1, "PLAY|2|") && expect(&p2, "PLAY|2|") &&
+                  board_of(&p2, piles) == n;
+done:
+    peer_close(&p1);
+    peer_close(&p2);
+}
+
+// with -O, a connection that never sends OPEN is closed
+static void open_timeout(void) {
+    Peer p;
+
+    results[16] = SKIP;
+    if(open_ms == 0) return;
+    if(!peer_connect(&p, "Silent")) return;
+    results[16] = closed_after(&p, deadline_in(0), open_ms);
+    peer_close(&p);
+}
+
+// with -T, player 1 never moves and loses by forfeit, both hear OVER
+static void turn_timeout(void) {
+    Peer p1, p2;
+    long long start;
+
+    results[17] = SKIP;
+    if(turn_ms == 0) return;
+    results[17] = FAIL;
+
+    if(!peer_connect(&p1, "Stalled") || !peer_connect(&p2, "Patient")) return;
+    if(pair_up(&p1, &p2) && expect(&p1, "PLAY|1|") && expect(&p2, "PLAY|1|")) {
+        start = deadline_in(0);
+        results[17] = expect_in(&p1, "OVER|2|", turn_ms + DEADLINE_MS) &&
+                      strstr(p1.frame, "|Forfeit|") != NULL &&
+                      expect(&p2, "OVER|2|") && strstr(p2.frame, "|Forfeit|") != NULL &&
+                      deadline_in(0) - start >= turn_ms - EARLY_MS;
+    }
+    peer_close(&p1);
+    peer_close(&p2);
+}
+
+// whether the server still holds p's connection after shutting its side
+// of it: a byte sent once it is closed is answered with a reset, which the
+// next send reports
+static int still_open(Peer *p) {
+    if(send(p->fd, "|", 1, MSG_NOSIGNAL) != 1) return 0;
+    usleep(50 * 1000);
+    return send(p->fd, "|", 1, MSG_NOSIGNAL) == 1;
+}
+
+// with -I, the winner of a walkout who goes quiet after OVER is closed; a
+// byte sent in time keeps the connection a while longer
+static void idle_timeout(void) {
+    Peer p1, p2;
+
+    results[18] = SKIP;
+    if(idle_ms == 0) return;
+    results[18] = FAIL;
 
-    // Test 8: Invalid quantity (Error 33)
-    send_ngp(p1, "MOVE|0|2|");
-    if(expect_response(p1, "FAIL|33")) printf("Test 8 (Error 33): PASS\n");
-    else printf("Test 8 (Error 33): FAIL\n");
+    if(!peer_connect(&p1, "Leaver") || !peer_connect(&p2, "Idler")) return;
+    if(pair_up(&p1, &p2) && expect(&p1, "PLAY|1|") && expect(&p2, "PLAY|1|")) {
+        peer_close(&p1);
+        if(expect_walkout(&p2, "OVER|2|") && closed_after(&p2, deadline_in(0), 0)) {
+            usleep(idle_ms / 2 * 1000);
+            if(still_open(&p2)) {
+                usleep((idle_ms + 100) * 1000);
+                results[18] = !still_open(&p2);
+            }
+        }
+    }
+    peer_close(&p1);
+    peer_close(&p2);
+}
+
+// p drops out of its game as player id and comes back with its token: it
+// hears NAME with the same opponent, then SESS with the same token
+static int rejoin(Peer *p, int id, const char *mode, const char *opp) {
+    char want[NGP_MAX_FRAME], token[TOKEN_LEN + 1];
+
+    memcpy(token, p->token, sizeof(token));
+    snprintf(want, sizeof(want), "NAME|%d|%s|", id, opp);
+    if(token[0] == '\0' || !reopen(p, mode, want)) return 0;
+
+    p->len = read_frame(p->fd, &p->in, p->frame, deadline_in(DEADLINE_MS));
+    return is_sess(p) && strcmp(p->token, token) == 0;
+}
+
+// with -R, player 1 drops out mid-game and comes back, twice, on whichever
+// worker its connection lands: the first time it gets the board as PLAY,
+// the second time it asks for deltas and gets SNAP, and the game goes on
+static void resume(void) {
+    Peer p1, p2;
+    int piles[MAX_PILES], seen[MAX_PILES];
+    char want[NGP_MAX_FRAME];
+    int n, ok;
+
+    results[19] = SKIP;
+    if(resume_ms == 0) return;
+    results[19] = FAIL;
+
+    if(!peer_connect(&p1, "Resumer") || !peer_connect(&p2, "Resumed")) return;
+    ok = pair_up(&p1, &p2) && expect(&p1, "PLAY|1|") && expect(&p2, "PLAY|1|");
+    n = board_of(&p2, piles);
+    ok = ok && n >= 2 && piles[0] >= 1 && piles[1] >= 2;
+
+    if(ok) {
+        send_ngp(p1.fd, "MOVE|0|1|");
+        piles[0]--;
+        ok = expect(&p1, "PLAY|2|") && expect(&p2, "PLAY|2|");
+    }
+    ok = ok && rejoin(&p1, 1, "", p2.name) && expect(&p1, "PLAY|2|") &&
+         board_of(&p1, seen) == n && memcmp(seen, piles, n * sizeof(*piles)) == 0;
+
+    if(ok) {
+        send_ngp(p2.fd, "MOVE|1|1|");
+        piles[1]--;
+        ok = expect(&p1, "PLAY|1|") && expect(&p2, "PLAY|1|");
+    }
+    ok = ok && rejoin(&p1, 1, "DELTA|", p2.name) && expect(&p1, "SNAP|1|2|");
 
-    close(p1);
-    close(p2);
+    if(ok) {
+        send_ngp(p1.fd, "MOVE|1|1|");
+        snprintf(want, sizeof(want), "DLTA|2|3|1|%d|", piles[1] - 1);
+        results[19] = expect(&p1, want) && expect(&p2, "PLAY|2|");
+    }
+    peer_close(&p1);
+    peer_close(&p2);
+}
+
+// with -R: a token is refused while its player is still in the game, a
+// wrong one is just an OPEN (of a name that is taken); once the grace
+// period is up the player who left forfeits, and the token is stale, so an
+// OPEN with it waits for a match like any other
+static void stale_tokens(void) {
+    Peer p1, p2, q, r;
+    long long left;
+    int ok;
+
+    results[20] = results[21] = SKIP;
+    if(resume_ms == 0) return;
+    results[20] = results[21] = FAIL;
+
+    r.fd = -1;
+    if(!peer_connect(&p1, "Dropper") || !peer_connect(&p2, "Winner")) return;
+    q = p1;
+    q.fd = -1;
+    if(!pair_up(&p1, &p2) || !expect(&p1, "PLAY|1|") || !expect(&p2, "PLAY|1|")) goto done;
+
+    memcpy(q.token, p1.token, sizeof(q.token));
+    ok = reopen(&q, "", "FAIL|22|");
+    left = deadline_in(0);
+    peer_close(&p1);
+    memcpy(q.token, p2.token, sizeof(q.token));
+    ok = ok && reopen(&q, "", "FAIL|22|");
+
+    results[21] = expect_walkout(&p2, "OVER|2|") && deadline_in(0) - left >= resume_ms - EARLY_MS;
+    if(!ok || !results[21]) goto done;
+
+    memcpy(q.token, p1.token, sizeof(q.token));
+    pthread_mutex_lock(&queue_lock);
+    // a partner connected any sooner could run into -O
+    ok = reopen(&q, "", "WAIT|") && peer_connect(&r, "Partner");
+    if(ok) {
+        peer_open(&r);
+        ok = expect(&q, "NAME|1|") && expect(&r, "WAIT|") && expect(&r, "NAME|2|");
+    }
+    pthread_mutex_unlock(&queue_lock);
+    results[20] = ok;
+done:
+    peer_close(&p1);
+    peer_close(&p2);
+    peer_close(&q);
+    peer_close(&r);
+}
+
+// start games until the server has no room, both players of the pair that
+// does not fit get FAIL 20; skipped if BUSY_PAIRS games all fit
+static void busy(void) {
+    static Peer p[2 * BUSY_PAIRS];
+    char name[32];
+    int i, n = 0;
+
+    results[12] = SKIP;
+    for(i = 0; i < BUSY_PAIRS; i++) {
+        snprintf(name, sizeof(name), "Busy%d", 2 * i);
+        if(!peer_connect(&p[n++], name)) break;
+        snprintf(name, sizeof(name), "Busy%d", 2 * i + 1);
+        if(!peer_connect(&p[n++], name)) break;
+
+        peer_open(&p[n - 2]);
+        if(!expect(&p[n - 2], "WAIT|")) {
+            results[12] = FAIL;
+            break;
+        }
+        peer_open(&p[n - 1]);
+        if(!expect(&p[n - 1], "WAIT|")) {
+            results[12] = FAIL;
+            break;
+        }
+        if(expect(&p[n - 1], "FAIL|20|")) {
+            results[12] = expect(&p[n - 2], "FAIL|20|");
+            break;
+        }
+        if(strncmp(p[n - 1].frame + NGP_HDR_LEN, "NAME|", 5) != 0) {
+            results[12] = FAIL;
+            break;
+        }
+    }
+    for(i = 0; i < n; i++) peer_close(&p[i]);
+}
+
+static void (*scenarios[])(void) = {
+    run_test_10, run_test_21, run_test_23, run_test_24, run_test_22,
+    game_errors, full_game, forfeit, pipelined, mixed_versions, delta_updates, move_cap,
+    open_timeout, turn_timeout, idle_timeout, resume, stale_tokens,
+};
+#define NSCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+static void *run_scenario(void *arg) {
+    scenarios[(long)arg]();
+    return NULL;
 }
 
 int main(int argc, char *argv[]) {
-    if(argc != 3) {
-        fprintf(stderr, "Usage: %s <host> <port>\n", argv[0]);
+    pthread_t tids[NSCENARIOS];
+    int i, opt;
+
+    while((opt = getopt(argc, argv, "k:O:T:I:R:")) != -1) {
+        switch(opt) {
+        case 'k':
+            max_take = atoi(optarg);
+            break;
+        case 'O':
+            open_ms = atoi(optarg);
+            break;
+        case 'T':
+            turn_ms = atoi(optarg);
+            break;
+        case 'I':
+            idle_ms = atoi(optarg);
+            break;
+        case 'R':
+            resume_ms = atoi(optarg);
+            break;
+        default:
+            argc = 0;
+        }
+    }
+    if(argc - optind != 2) {
+        fprintf(stderr, "Usage: %s [-k max_take] [-O open_ms] [-T turn_ms] [-I idle_ms] [-R resume_ms] <host> <port>\n", argv[0]);
         exit(1);
     }
-    run_test_10(argv[1], argv[2]);
-    run_test_21(argv[1], argv[2]);
-    run_test_23(argv[1], argv[2]);
-    run_test_24(argv[1], argv[2]);
-    run_test_22(argv[1], argv[2]);
-    game_errors(argv[1], argv[2]);
+    host = argv[optind];
+    port = argv[optind + 1];
+
+    for(i = 0; i < NSCENARIOS; i++) {
+        pthread_create(&tids[i], NULL, run_scenario, (void *)(long)i);
+    }
+    for(i = 0; i < NSCENARIOS; i++) pthread_join(tids[i], NULL);
+    busy();
+
+    for(i = 1; i <= NTESTS; i++) {
+        printf("%s: %s\n", titles[i], results[i] == PASS ? "PASS" :
+                                      results[i] == SKIP ? "SKIP" : "FAIL");
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <string.h>
+#include "nimd.h"
+
+// Hierarchical timer wheel, one per event loop shard. Ticks are milliseconds.
+// Level l has 64 slots of 64^l ticks each; a timer sits in the level its
+// distance from now fits in, and when the clock enters a slot on an upper
+// level, the timers there cascade down a level. Arming and cancelling are a
+// list link and unlink, and each level keeps a bitmap of its slots that are
+// in use, so the clock jumps straight to the next tick with work instead of
+// walking every millisecond.
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+#define LEVEL_SPAN(l) (1LL << (6 * (l)))
+#define WHEEL_SPAN LEVEL_SPAN(WHEEL_LEVELS)   // furthest a timer is placed
+
+static void list_push(Timer **head, Timer *t) {
+    t->next = *head;
+    if(t->next != NULL) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+static void list_unlink(Timer *t) {
+    *t->pprev = t->next;
+    if(t->next != NULL) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+static void place(Wheel *w, Timer *t) {
+    long long delta = t->expires - w->now;
+    long long at = t->expires;
+    int l, slot;
+
+    if(delta <= 0) {
+        t->where = -1;
+        list_push(&w->due, t);
+        return;
+    }
+
+    // past the top level it waits in the furthest slot and cascades again
+    if(delta >= WHEEL_SPAN) {
+        delta = WHEEL_SPAN - 1;
+        at = w->now + delta;
+    }
+
+    for(l = 0; delta >= LEVEL_SPAN(l + 1); l++);
+    slot = (at >> (6 * l)) & SLOT_MASK;
+
+    t->where = l * WHEEL_SLOTS + slot;
+    list_push(&w->slots[l][slot], t);
+    w->used[l] |= 1ULL << slot;
+}
+
+void wheel_init(Wheel *w, long long now) {
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+}
+
+// take a timer out of the wheel, nothing happens if it is not armed
+void timer_cancel(Wheel *w, Timer *t) {
+    int l, slot;
+
+    if(t->pprev == NULL) return;
+
+    list_unlink(t);
+    if(t->where >= 0) {
+        l = t->where / WHEEL_SLOTS;
+        slot = t->where % WHEEL_SLOTS;
+        if(w->slots[l][slot] == NULL) w->used[l] &= ~(1ULL << slot);
+        w->armed--;
+    }
+}
+
+// (re)arm a timer to fire at tick expires
+void timer_arm(Wheel *w, Timer *t, long long expires) {
+    timer_cancel(w, t);
+    t->expires = expires;
+    place(w, t);
+    if(t->where >= 0) w->armed++;
+}
+
+// ticks from now until the clock next enters a slot in use, -1 if none is
+static long long next_work(Wheel *w) {
+    long long best = -1, d, tick;
+    uint64_t used;
+    int l, idx, k;
+
+    for(l = 0; l < WHEEL_LEVELS; l++) {
+        if(w->used[l] == 0) continue;
+
+        // nearest slot in use after the current one, going round
+        idx = (w->now >> (6 * l)) & SLOT_MASK;
+        used = idx == SLOT_MASK ? w->used[l]
+                                : (w->used[l] >> (idx + 1)) | (w->used[l] << (SLOT_MASK - idx));
+        k = __builtin_ctzll(used) + 1;
+
+        tick = ((w->now >> (6 * l)) + k) << (6 * l);
+        d = tick - w->now;
+        if(best < 0 || d < best) best = d;
+    }
+    return best;
+}
+
+// move the clock to now, collecting every timer that came due
+void wheel_advance(Wheel *w, long long now) {
+    Timer *list, *t;
+    long long d;
+    int l, slot;
+
+    while(w->now < now) {
+        d = w->armed ? next_work(w) : -1;
+        if(d < 0 || w->now + d > now) {
+            w->now = now;
+            return;
+        }
+        w->now += d;
+
+        // entering a slot on an upper level brings its timers down
+        for(l = 1; l < WHEEL_LEVELS && (w->now & (LEVEL_SPAN(l) - 1)) == 0; l++) {
+            slot = (w->now >> (6 * l)) & SLOT_MASK;
+            list = w->slots[l][slot];
+            w->slots[l][slot] = NULL;
+            w->used[l] &= ~(1ULL << slot);
+
+            while((t = list) != NULL) {
+                list = t->next;
+                t->pprev = NULL;
+                w->armed--;
+                timer_arm(w, t, t->expires);
+            }
+        }
+
+        slot = w->now & SLOT_MASK;
+        while((t = w->slots[0][slot]) != NULL) {
+            list_unlink(t);
+            w->armed--;
+            t->where = -1;
+            list_push(&w->due, t);
+        }
+        w->used[0] &= ~(1ULL << slot);
+    }
+}
+
+// next timer that came due, taken out of the wheel, NULL once there are none
+Timer *wheel_expired(Wheel *w) {
+    Timer *t = w->due;
+
+    if(t != NULL) list_unlink(t);
+    return t;
+}
+
+// milliseconds the owner may sleep before the wheel has work, -1 for ever
+int wheel_timeout(Wheel *w) {
+    long long d;
+
+    if(w->due != NULL) return 0;
+    d = w->armed ? next_work(w) : -1;
+    if(d > 1000000) d = 1000000;    // epoll takes an int
+    return (int)d;
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "nimd.h"
+
+// Checks the timer wheel (timer.c) against a brute-force list of deadlines.
+// Timers are armed anywhere from now to past the span of the top level, so
+// they cascade through all 4 levels, and while the clock runs some are
+// cancelled and some re-armed, armed or not. Every timer must fire once, for
+// the deadline it was last armed with, and a cancelled one never. The clock
+// either steps to the tick wheel_timeout says has work next, where each timer
+// must fire exactly on its deadline, or jumps at random, where everything
+// due by then and nothing else must have fired. Run as ./timertest [seed],
+// it exits 1 if anything disagrees.
+
+#define NTIMERS 1024
+#define ROUNDS 8
+#define CHURN_STEPS 2000    // steps in a round that arm and cancel timers
+
+static Timer timers[NTIMERS];
+static long long due[NTIMERS];  // tick each armed timer must fire at, -1 if none
+static long fired;
+static int failures;
+
+static long long rnd(void) {
+    return (long long)random() << 31 | random();
+}
+
+// a deadline relative to now: often soon, sometimes on an upper level and
+// now and then past the whole wheel, which must wait and cascade again
+static long long distance(void) {
+    int level = random() % 6;
+
+    if(random() % 16 == 0) return 0;
+    return 1 + rnd() % (1LL << (6 * level));
+}
+
+static void arm(Wheel *w, int i) {
+    long long d = distance();
+
+    timer_arm(w, &timers[i], w->now + d);
+    due[i] = w->now + d;
+}
+
+static void fail(const Wheel *w, int i, const char *what) {
+    if(failures++ < 10) {
+        fprintf(stderr, "timer %d at tick %lld (due %lld): %s\n", i, w->now, due[i], what);
+    }
+}
+
+// take what fired and hold it against the list, returns how many are still
+// armed, -1 if the wheel lost count of them
+static int collect(Wheel *w, int exact) {
+    Timer *t;
+    int i, armed = 0;
+
+    while((t = wheel_expired(w)) != NULL) {
+        i = t - timers;
+        if(due[i] < 0) fail(w, i, "fired while not armed");
+        else if(due[i] > w->now) fail(w, i, "fired early");
+        else if(exact && due[i] != w->now) fail(w, i, "fired late");
+        due[i] = -1;
+        fired++;
+    }
+
+    for(i = 0; i < NTIMERS; i++) {
+        if(due[i] < 0) continue;
+        armed++;
+        if(due[i] <= w->now) {
+            fail(w, i, "did not fire");
+            due[i] = -1;
+        }
+    }
+    if(armed != w->armed) {
+        fprintf(stderr, "tick %lld: wheel counts %d armed, %d are\n", w->now, w->armed, armed);
+        failures++;
+        return -1;
+    }
+    return armed;
+}
+
+static void round_of(Wheel *w, int exact) {
+    long long start = rnd() % (1LL << 40);
+    long steps;
+    int i, k, d, armed;
+
+    wheel_init(w, start);
+    for(i = 0; i < NTIMERS; i++) {
+        timers[i].pprev = NULL;
+        arm(w, i);
+    }
+    if(collect(w, exact) < 0) return;
+
+    for(steps = 0; ; steps++) {
+        // a few timers change, armed ones included
+        for(k = steps < CHURN_STEPS ? random() % 4 : 0; k > 0; k--) {
+            i = random() % NTIMERS;
+            if(random() % 3 == 0) {
+                timer_cancel(w, &timers[i]);
+                due[i] = -1;
+            } else {
+                arm(w, i);
+            }
+        }
+        armed = collect(w, exact);
+        if(armed <= 0) return;
+
+        if(exact) {
+            d = wheel_timeout(w);
+            if(d <= 0) {
+                fprintf(stderr, "tick %lld: timeout %d with timers armed\n", w->now, d);
+                failures++;
+                return;
+            }
+        } else {
+            d = 1 + rnd() % (1LL << (random() % 26));
+        }
+        wheel_advance(w, w->now + d);
+        if(collect(w, exact) < 0) return;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static Wheel w;
+    int r;
+
+    srandom(argc > 1 ? atoi(argv[1]) : 1);
+    for(r = 0; r < ROUNDS; r++) round_of(&w, r % 2 == 0);
+
+    printf("Timer wheel: %s (%ld timers fired over %d rounds)\n", failures ? "FAIL" : "PASS",
+           fired, ROUNDS);
+    return failures ? 1 : 0;
+}
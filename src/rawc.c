@@ -1,6 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <poll.h>
 #include "network.h"
@@ -8,11 +9,128 @@
 
 #define BUFLEN 256
 
+// With -1 rawc speaks binary NGP v1: a typed line "OPEN name [token] [DELTA]",
+// "MOVE pile count" or "SYNC" goes out as a v1 frame (anything else as
+// typed), and every whole frame received is also shown decoded.
+static int v1;
+static unsigned char frames[BUFLEN * 2];
+static int nframes;
+
+// the typed line as a v1 frame in out, returns its length, 0 if it is
+// none of OPEN, MOVE and SYNC
+static int
+encode_v1 (char *line, char *out)
+{
+    char name[BUFLEN], token[BUFLEN], mode[BUFLEN];
+    int pile, count, n, t, delta, fields;
+
+    fields = sscanf (line, "OPEN %255s %255s %255s", name, token, mode);
+    if (fields >= 1) {
+	// DELTA may come with or without a token
+	delta = (fields == 3 && strcmp (mode, "DELTA") == 0) ||
+	    (fields == 2 && strcmp (token, "DELTA") == 0);
+	n = strlen (name);
+	t = fields >= 2 && strcmp (token, "DELTA") != 0 ? strlen (token) : 0;
+	if (t > 16) t = 16;
+	if (n > 99 - t) n = 99 - t;
+	out[0] = '1';
+	out[1] = 2 + n + t + delta;
+	out[2] = 'O';
+	out[3] = n;
+	memcpy (out + 4, name, n);
+	memcpy (out + 4 + n, token, t);
+	if (delta) out[4 + n + t] = 1;
+	return 4 + n + t + delta;
+    }
+
+    if (strncmp (line, "SYNC", 4) == 0) {
+	out[0] = '1';
+	out[1] = 1;
+	out[2] = 'Y';
+	return 3;
+    }
+
+    if (sscanf (line, "MOVE %d %d", &pile, &count) == 2) {
+	out[0] = '1';
+	out[1] = 3;
+	out[2] = 'M';
+	out[3] = pile;
+	out[4] = count;
+	return 5;
+    }
+    return 0;
+}
+
+// show the whole v1 frames received so far
+static void
+show_v1 (void)
+{
+    unsigned char *f = frames;
+    int n, i, at;
+
+    while (nframes >= 2 && nframes >= 2 + f[1]) {
+	n = 2 + f[1];
+	if (f[0] != '1' || n < 3) {
+	    // not v1, nothing after it can be framed
+	    nframes = 0;
+	    return;
+	}
+
+	at = n;
+	printf ("  = ");
+	switch (f[2]) {
+	case 'W':
+	    printf ("WAIT");
+	    break;
+	case 'N':
+	    if (n > 3) printf ("NAME %d %.*s", f[3], n - 4, (char *) f + 4);
+	    break;
+	case 'S':
+	    printf ("SESS %.*s", n - 3, (char *) f + 3);
+	    break;
+	case 'P':
+	    if (n > 3) printf ("PLAY %d", f[3]);
+	    at = 4;
+	    break;
+	case 'B':
+	    if (n > 5) printf ("SNAP %d seq %d", f[3], f[4] << 8 | f[5]);
+	    at = 6;
+	    break;
+	case 'D':
+	    if (n > 7) printf ("DLTA %d seq %d pile %d left %d", f[3], f[4] << 8 | f[5], f[6], f[7]);
+	    break;
+	case 'R':
+	    if (n > 4) printf ("OVER %d%s", f[3], f[4] ? " Forfeit" : "");
+	    at = 5;
+	    break;
+	case 'F':
+	    if (n > 3) printf ("FAIL %d", f[3]);
+	    break;
+	default:
+	    printf ("type %c", f[2]);
+	}
+	for (i = at; i < n; i++) {
+	    printf (" %d", f[i]);
+	}
+	printf ("\n");
+
+	memmove (frames, frames + n, nframes - n);
+	nframes -= n;
+    }
+}
+
 int
 main (int argc, char **argv)
 {
+    if (argc > 1 && strcmp (argv[1], "-1") == 0) {
+	v1 = 1;
+	argv[1] = argv[0];
+	argv++;
+	argc--;
+    }
+
     if (argc < 3) {
-	printf ("Usage: %s host port\n", argv[0]);
+	printf ("Usage: %s [-1] host port\n", argv[0]);
 	exit (EXIT_FAILURE);
     }
 
@@ -25,8 +143,8 @@ main (int argc, char **argv)
     pfds[1].fd     = sock;
     pfds[1].events = POLLIN;
 
-    char buf[BUFLEN];
-    int bytes;
+    char buf[BUFLEN], frame[BUFLEN];
+    int bytes, len;
 
     for (;;) {
 	int ready = poll (pfds, 2, -1);
@@ -36,7 +154,7 @@ main (int argc, char **argv)
 	}
 
 	if (pfds[0].revents) {
-	    bytes = read (STDIN_FILENO, buf, BUFLEN);
+	    bytes = read (STDIN_FILENO, buf, BUFLEN - 1);
 
 	    if (bytes < 1) {
 		printf("Exiting\n");
@@ -47,6 +165,13 @@ main (int argc, char **argv)
 		bytes--;
 	    }
 
+	    buf[bytes] = '\0';
+	    if (v1 && (len = encode_v1 (buf, frame)) > 0) {
+		printf ("Sending %d byte frame\n", len);
+		write (sock, frame, len);
+		continue;
+	    }
+
 	    printf ("Sending %d bytes\n", bytes);
 	    write (sock, buf, bytes);
 	}
@@ -63,6 +188,13 @@ main (int argc, char **argv)
 	    print_buffer (buf, bytes);
 	    printf ("]\n");
 
+	    if (v1) {
+		if (bytes > (int) sizeof (frames) - nframes) nframes = 0;
+		memcpy (frames + nframes, buf, bytes);
+		nframes += bytes;
+		show_v1 ();
+	    }
+
 	}
 
     }